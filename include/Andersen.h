@@ -45,16 +45,127 @@
 #ifndef TCFS_ANDERSEN_H
 #define TCFS_ANDERSEN_H
 
+#include "CSRGraph.h"
 #include "Constraint.h"
 #include "NodeFactory.h"
 #include "PtsSet.h"
+#include "PtsSetStore.h"
 
 #include "llvm/ADT/DenseMap.h"
 #include "llvm/IR/CallSite.h"
 #include "llvm/IR/DataLayout.h"
+#include "llvm/IR/ValueHandle.h"
+#include "llvm/Transforms/Utils/ValueMapper.h"
 
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <list>
 #include <vector>
 
+class Andersen;
+class OfflineConstraintGraph;
+
+// Tells the analysis when a value it has nodes for is replaced or deleted
+class AndersValueHandle : public llvm::CallbackVH {
+private:
+  Andersen *anders;
+
+public:
+  AndersValueHandle(llvm::Value *v, Andersen *a) : CallbackVH(v), anders(a) {}
+
+  void deleted() override;
+  void allUsesReplacedWith(llvm::Value *) override;
+};
+
+// Facts about a points-to set in the result store. They are computed once
+// after solving, so that queries can read them in constant time
+struct AndersPtsSetFacts {
+  // The elements of the set, sorted
+  llvm::ArrayRef<NodeIndex> elements;
+  // The id of the set in the store. Equal sets have equal ids
+  unsigned setId;
+  // A hash of the elements. Equal sets have equal fingerprints
+  std::size_t fingerprint;
+  // A 64-bit Bloom filter of the elements other than the null object. Sets
+  // whose signatures don't overlap share no such element
+  uint64_t signature;
+  unsigned size;
+  // The only element of the set, or InvalidIndex if the size is not 1
+  NodeIndex singleElement;
+  // The set contains the null object and nothing else
+  bool isNullOnly;
+  // The set contains the universal object, i.e. it may point to anything
+  bool hasUniversalObj;
+  // Every object in the set (and every object they stand for) is constant
+  // memory
+  bool isConstantMemory;
+};
+
+// A read-only view of the points-to set of a pointer, as handed out by
+// Andersen::getPointsToSetView(). It refers to the set stored in the analysis,
+// so it is cheap to copy and stays valid as long as the analysis does.
+// The view holds the object nodes of the set as they are stored. They include
+// the null object, and objects that stand for location equivalent objects.
+// Andersen::getAllocationSiteFor() and Andersen::getLocationEquivalents()
+// translate them when needed
+class AndersPtsSetView {
+private:
+  const AndersPtsSetFacts *facts;
+
+  AndersPtsSetView(const AndersPtsSetFacts *f) : facts(f) {}
+
+public:
+  using iterator = llvm::ArrayRef<NodeIndex>::iterator;
+
+  AndersPtsSetView() : facts(nullptr) {}
+
+  bool isValid() const { return facts != nullptr; }
+
+  iterator begin() const {
+    assert(isValid());
+    return facts->elements.begin();
+  }
+  iterator end() const {
+    assert(isValid());
+    return facts->elements.end();
+  }
+
+  // Unlike AndersPtsSet::getSize(), these are constant time operations
+  unsigned getSize() const {
+    assert(isValid());
+    return facts->size;
+  }
+  bool isEmpty() const { return getSize() == 0; }
+
+  // The stored sets are deduplicated, so views have equal contents iff they
+  // have the same id
+  unsigned getSetId() const {
+    assert(isValid());
+    return facts->setId;
+  }
+  // Views with different fingerprints have different contents
+  std::size_t getFingerprint() const {
+    assert(isValid());
+    return facts->fingerprint;
+  }
+
+  bool intersectWith(const AndersPtsSetView &other) const {
+    assert(isValid() && other.isValid());
+    return AndersPtsSetStore::intersectWith(facts->elements,
+                                            other.facts->elements);
+  }
+
+  bool operator==(const AndersPtsSetView &other) const {
+    return getSetId() == other.getSetId();
+  }
+  bool operator!=(const AndersPtsSetView &other) const {
+    return !(*this == other);
+  }
+
+  friend class Andersen;
+};
+
 class Andersen {
 private:
   // A factory object that knows how to manage AndersNodes
@@ -64,13 +175,49 @@ private:
   // identified by the program.
   std::vector<AndersConstraint> constraints;
 
-  // This is the points-to graph generated by the analysis
+  // This is the points-to graph generated by the analysis. It is only
+  // needed while solving. Its sets hold object ids, not node indices, which
+  // keeps their bits dense
   std::map<NodeIndex, AndersPtsSet> ptsGraph;
 
+  // The solution, once solving is done: ptsSetStore holds every distinct
+  // points-to set once, and repSetIds maps a representative to the id of its
+  // set. Set EmptySetId is always the empty set
+  AndersPtsSetStore ptsSetStore;
+  llvm::DenseMap<NodeIndex, unsigned> repSetIds;
+  static const unsigned EmptySetId = 0;
+
+  // The reverse of the solution, built on the first getPointedBy() query.
+  // pointedByGraph maps an object to the representatives whose points-to sets
+  // contain it, repMemberGraph maps a representative to the value nodes merged
+  // into it, and locEquivRep maps a location equivalent object to the object
+  // that stands for it in points-to sets
+  mutable CSRGraph pointedByGraph, repMemberGraph;
+  mutable llvm::DenseMap<NodeIndex, NodeIndex> locEquivRep;
+  mutable bool pointedByBuilt;
+  // Whether freeze() has been called
+  bool frozen;
+
+  // The facts of every set in ptsSetStore, indexed by set id
+  std::vector<AndersPtsSetFacts> ptsSetFacts;
+
+  // A handle on every value the node factory has nodes for, so that the
+  // factory follows the values through RAUW and deletion
+  std::list<AndersValueHandle> valueHandles;
+  llvm::DenseMap<const llvm::Value *, std::list<AndersValueHandle>::iterator>
+      valueHandleMap;
+  // Bumped whenever a value is replaced, removed or copied
+  unsigned valueEpoch;
+
+  // The optimization and solving phases, in case they run on a background
+  // thread. Until they finish, nothing but the IR maintenance interfaces may
+  // touch the analysis on the main thread
+  mutable std::future<void> pendingSolve;
+
   // Three main phases
   void collectConstraints(const llvm::Module &);
-  void optimizeConstraints();
-  void solveConstraints();
+  void optimizeConstraints(OfflineConstraintGraph &);
+  void solveConstraints(OfflineConstraintGraph &);
 
   // Helper functions for constraint collection
   void collectConstraintsForGlobals(const llvm::Module &);
@@ -82,6 +229,29 @@ private:
   void addArgumentConstraintForCall(llvm::ImmutableCallSite cs,
                                     const llvm::Function *f);
 
+  // Helper functions for solving in the background. solve() doesn't read the
+  // IR, so that the rest of the pipeline may change it meanwhile.
+  // finishSolve() does, so it runs on the querying thread
+  void solve();
+  void finishSolve();
+  void waitForSolve() const;
+
+  // Helper functions for queries
+  bool isConstantMemoryNode(NodeIndex) const;
+  AndersPtsSetFacts computePtsSetFacts(unsigned setId) const;
+  // Return nullptr if the representative n has no points-to set
+  const AndersPtsSetFacts *getPtsSetFacts(NodeIndex n) const {
+    auto itr = repSetIds.find(n);
+    if (itr == repSetIds.end())
+      return nullptr;
+    return &ptsSetFacts[itr->second];
+  }
+  void buildPointedByIndex() const;
+
+  // Helper functions for IR maintenance
+  void trackValue(const llvm::Value *);
+  void untrackValue(const llvm::Value *);
+
   // Helper functions for constraint optimization
   NodeIndex getRefNodeIndex(NodeIndex n) const;
   NodeIndex getAdrNodeIndex(NodeIndex n) const;
@@ -95,8 +265,26 @@ private:
 public:
   static char ID;
 
-  Andersen(const llvm::Module &);
-  bool runOnModule(const llvm::Module &M);
+  // If async is true, only the constraints are collected before returning.
+  // The rest of the analysis runs on a background thread, and the first
+  // query waits for it
+  Andersen(const llvm::Module &, bool async = false);
+  // The value handles refer back to the analysis
+  Andersen(const Andersen &) = delete;
+  Andersen &operator=(const Andersen &) = delete;
+  ~Andersen();
+  bool runOnModule(const llvm::Module &M, bool async = false);
+
+  // Return true if the queries below can be answered without waiting for
+  // the background solve
+  bool isSolved() const;
+
+  // Make the analysis result immutable. Until then, the query interfaces below
+  // may update internal state (e.g. getPointedBy() builds its index on the
+  // first call). Afterwards, they only read it, so they are safe to call from
+  // several threads at once without locking
+  void freeze();
+  bool isFrozen() const { return frozen; }
 
   // Given a llvm pointer v,
   // - Return false if the analysis doesn't know where v points to. In other
@@ -105,11 +293,54 @@ public:
   // argument.
   bool getPointsToSet(const llvm::Value *v,
                       std::vector<const llvm::Value *> &ptsSet) const;
+  // Same as getPointsToSet(), except that a view of the stored points-to set
+  // is put into the second argument. Nothing is copied or allocated
+  bool getPointsToSetView(const llvm::Value *v, AndersPtsSetView &view) const;
+  // Return the allocation site of an object from a points-to set view, or
+  // nullptr if it has none (e.g. the null object)
+  const llvm::Value *getAllocationSiteFor(NodeIndex obj) const {
+    waitForSolve();
+    return nodeFactory.getValueForNode(obj);
+  }
+  // Return the objects (other than obj itself) that obj stands for in
+  // points-to sets
+  llvm::ArrayRef<NodeIndex> getLocationEquivalents(NodeIndex obj) const {
+    waitForSolve();
+    return nodeFactory.getLocationEquivalents(obj);
+  }
+  // Given an allocation site alloc,
+  // - Return false if alloc is not a memory object known to the analysis.
+  // - Return true otherwise, and put every pointer that may point to alloc
+  // into the second argument. This includes the pointers that may point to
+  // anything.
+  bool getPointedBy(const llvm::Value *alloc,
+                    std::vector<const llvm::Value *> &ptrs) const;
   // Put all allocation sites (i.e. all memory objects identified by the
   // analysis) into the first arugment
   void
   getAllAllocationSites(std::vector<const llvm::Value *> &allocSites) const;
 
+  // Keep the analysis result usable while the IR changes, without solving
+  // again. A replacement takes over the nodes of the value it replaces, a
+  // clone shares the representative (and the object) of its origin, and a
+  // deleted value drops out. The value handles call replaceValue() and
+  // removeValue() on RAUW and deletion. Whoever clones IR calls copyValue(),
+  // e.g. with the value map that CloneFunction() fills in. Values without
+  // nodes (e.g. instructions that an inliner cloned without telling us) stay
+  // unknown to the analysis, which is always safe. A clone is a different
+  // value at run time, so it and its origin may-alias, but no longer
+  // must-alias (see AndersNodeFactory::hasValueCopies()).
+  // None of these are safe to call while other threads query the analysis,
+  // and they undo freeze(), which has to be called again afterwards. RAUW and
+  // deletion don't wait for a background solve, but copyValue() does
+  void replaceValue(const llvm::Value *oldVal, const llvm::Value *newVal);
+  void removeValue(const llvm::Value *);
+  void copyValue(const llvm::Value *from, const llvm::Value *to);
+  void copyValues(const llvm::ValueToValueMapTy &);
+  // Bumped whenever replaceValue(), removeValue() or copyValue() runs, so that
+  // clients can tell when something they cached about a value may be stale
+  unsigned getValueEpoch() const { return valueEpoch; }
+
   friend class AndersenAAResult;
 };
 
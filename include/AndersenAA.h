@@ -3,24 +3,129 @@
 
 #include "Andersen.h"
 
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/IR/PassManager.h"
 #include "llvm/Pass.h"
 
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace llvm {
+class PassBuilder;
+}
+
 class AndersenAAResult : public llvm::AAResultBase<AndersenAAResult> {
 private:
   friend llvm::AAResultBase<AndersenAAResult>;
 
-  Andersen anders;
+  // The new pass manager moves results around, and the analysis holds
+  // pointers into itself, so keep it at a fixed address
+  std::unique_ptr<Andersen> anders;
+
+  // What a pointer resolves to: the representative of its value node (or
+  // InvalidIndex if it has none), and the facts of the points-to set of the
+  // representative (or nullptr if it has none). hasCopies is true if the
+  // representative stands for clones of a value, which must not must-alias
+  // each other
+  struct PointerInfo {
+    NodeIndex rep;
+    const AndersPtsSetFacts *facts;
+    bool hasCopies;
+  };
+
+  // The analysis result never changes once it is computed, so query results
+  // can be memoized, as long as no value is replaced, removed or copied.
+  // ptrCache maps a pointer to its PointerInfo, and aliasCache maps a pair of
+  // representatives (the smaller one first) to their alias result
+  llvm::DenseMap<const llvm::Value *, PointerInfo> ptrCache;
+  llvm::DenseMap<std::pair<NodeIndex, NodeIndex>, llvm::AliasResult> aliasCache;
+  // Once frozen, the caches are neither read nor updated
+  bool frozen;
+  // The value epoch of the analysis that the caches were filled in
+  unsigned ptrCacheEpoch;
+
+  PointerInfo lookupPointerInfo(const llvm::Value *) const;
+  PointerInfo getPointerInfo(const llvm::Value *);
   llvm::AliasResult andersenAlias(const llvm::Value *, const llvm::Value *);
+  llvm::AliasResult computeAlias(const AndersPtsSetFacts &,
+                                 const AndersPtsSetFacts &) const;
 
 public:
-  AndersenAAResult(const llvm::Module &);
+  // In asynchronous mode, the analysis is solved on a background thread, and
+  // the first query blocks until it is done. Passes that run in the meantime
+  // may change the IR. See Andersen::Andersen()
+  AndersenAAResult(const llvm::Module &, bool async = false);
+
+  // Return true if queries no longer have to wait for the background solve
+  bool isReady() const { return anders->isSolved(); }
 
   llvm::AliasResult alias(const llvm::MemoryLocation &,
                           const llvm::MemoryLocation &);
   bool pointsToConstantMemory(const llvm::MemoryLocation &, bool);
+
+  // Like the other module-level alias analyses, the result only answers
+  // queries about values it knows, and it follows them through RAUW and
+  // deletion. So it stays usable until a pass explicitly abandons AndersenAA
+  // (e.g. "invalidate<anders-aa>")
+  bool invalidate(llvm::Module &, const llvm::PreservedAnalyses &,
+                  llvm::ModuleAnalysisManager::Invalidator &);
+
+  // Make the result immutable. Afterwards alias(), pointsToConstantMemory()
+  // and getAliasClasses() no longer memoize anything, so they are safe to call
+  // from several threads at once without locking. Their lookups are constant
+  // time anyway once the analysis is frozen. Cloning or changing the IR
+  // undoes it, so isFrozen() is false until it is called again
+  void freeze();
+  bool isFrozen() const { return frozen && anders->isFrozen(); }
+
+  // Let the clones of IR share the analysis result of their origins. See
+  // Andersen::copyValue()
+  void copyValue(const llvm::Value *from, const llvm::Value *to) {
+    anders->copyValue(from, to);
+  }
+  void copyValues(const llvm::ValueToValueMapTy &vmap) {
+    anders->copyValues(vmap);
+  }
+
+  // Partition ptrs into may-alias classes, so that two pointers share a class
+  // iff they are connected by a chain of pointers that may alias each other.
+  // classes[i] is set to the class of ptrs[i], and the number of classes is
+  // returned. If matrix is not null, it is set to the alias result of every
+  // pair of pointers, so that (*matrix)[i * ptrs.size() + j] is what alias()
+  // says about ptrs[i] and ptrs[j] (with non-zero sizes).
+  // This costs one pass over the distinct points-to sets of the pointers,
+  // rather than one alias() query per pair
+  unsigned getAliasClasses(llvm::ArrayRef<const llvm::Value *> ptrs,
+                           std::vector<unsigned> &classes,
+                           std::vector<llvm::AliasResult> *matrix = nullptr);
+};
+
+// The analysis for the new pass manager. The result is computed once per
+// module and cached by the module analysis manager until a pass invalidates
+// it. Function passes can't compute it themselves, but once a module pass such
+// as "require<anders-aa>" has run, they see the cached result through
+// ModuleAnalysisManagerFunctionProxy. The AA aggregation picks it up the same
+// way, with AAManager::registerModuleAnalysis<AndersenAA>() or "anders-aa" in
+// the AA pipeline
+class AndersenAA : public llvm::AnalysisInfoMixin<AndersenAA> {
+private:
+  friend llvm::AnalysisInfoMixin<AndersenAA>;
+  static llvm::AnalysisKey Key;
+
+public:
+  typedef AndersenAAResult Result;
+
+  AndersenAAResult run(llvm::Module &, llvm::ModuleAnalysisManager &);
 };
 
+// Register AndersenAA and its pipeline names ("require<anders-aa>",
+// "invalidate<anders-aa>" and, where the PassBuilder supports it, the
+// "anders-aa" AA name) with a PassBuilder
+void registerAndersenAA(llvm::PassBuilder &);
+
 class AndersenAAWrapperPass : public llvm::ModulePass {
 private:
   std::unique_ptr<AndersenAAResult> result;
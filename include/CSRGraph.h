@@ -0,0 +1,215 @@
+#ifndef ANDERSEN_CSR_GRAPH_H
+#define ANDERSEN_CSR_GRAPH_H
+
+#include "GraphTraits.h"
+#include "NodeFactory.h"
+
+#include "llvm/ADT/BitVector.h"
+
+#include <algorithm>
+#include <cassert>
+#include <vector>
+
+// The node of a CSRGraph. The edges of a node are a contiguous slice of the
+// edge array of the graph, and come in two groups: the primary edges followed
+// by the secondary edges. Traversals may follow the primary edges only, or
+// both groups
+class CSRGraphNode {
+private:
+  const NodeIndex *edgeBegin;
+  unsigned numPrimary, numEdges;
+  NodeIndex idx;
+
+  CSRGraphNode(NodeIndex i)
+      : edgeBegin(nullptr), numPrimary(0), numEdges(0), idx(i) {}
+
+public:
+  typedef const NodeIndex *iterator;
+
+  NodeIndex getNodeIndex() const { return idx; }
+
+  // All the edges
+  iterator begin() const { return edgeBegin; }
+  iterator end() const { return edgeBegin + numEdges; }
+  // The primary edges are [begin(), primary_end())
+  iterator primary_end() const { return edgeBegin + numPrimary; }
+
+  unsigned getNumEdges() const { return numEdges; }
+  unsigned getNumPrimaryEdges() const { return numPrimary; }
+
+  friend class CSRGraph;
+};
+
+// A static graph in compressed sparse row form: the edges of all nodes are
+// stored in one array, and node n owns a slice of it. Nodes are indexed by
+// NodeIndex in [0, getNumNodes()). The graph cannot be modified once it is
+// built. Users that need to merge nodes either look the merge targets up when
+// they traverse the edges, or build a new graph.
+class CSRGraph {
+private:
+  std::vector<CSRGraphNode> nodes;
+  std::vector<NodeIndex> edges;
+  // The nodes that are an endpoint of some edge
+  llvm::BitVector inGraph;
+
+public:
+  // Build a CSRGraph in two passes over the same edges. Every edge is first
+  // passed to addEdge() to count the edges of each node. After
+  // startFilling(), the same edges are passed to addEdge() again to fill them
+  // in, and finish() hands out the graph. Duplicate edges are removed
+  class Builder {
+  private:
+    unsigned numNodes;
+    bool filling;
+    // During counting, rowPos[2n] and rowPos[2n + 1] are the number of primary
+    // and secondary edges of node n. During filling, they are the positions
+    // right after the last unfilled slot of the corresponding rows
+    std::vector<unsigned> rowPos;
+    std::vector<NodeIndex> edges;
+
+  public:
+    explicit Builder(unsigned n)
+        : numNodes(n), filling(false), rowPos(2 * n + 1, 0) {}
+
+    void addEdge(NodeIndex src, NodeIndex dst, bool isSecondary = false) {
+      assert(src < numNodes && dst < numNodes && "Node out of range!");
+      unsigned row = 2 * src + (isSecondary ? 1 : 0);
+      if (filling)
+        edges[--rowPos[row]] = dst;
+      else
+        ++rowPos[row];
+    }
+
+    void startFilling() {
+      assert(!filling && "Filling has started already!");
+      // After the prefix sum, rowPos[row] is where the next row starts
+      for (unsigned row = 1, e = rowPos.size(); row < e; ++row)
+        rowPos[row] += rowPos[row - 1];
+      edges.resize(rowPos.back());
+      filling = true;
+    }
+
+    void finish(CSRGraph &graph) {
+      assert(filling && "The edges have not been filled in!");
+      graph.releaseMemory();
+      graph.nodes.reserve(numNodes);
+      graph.inGraph.resize(numNodes);
+
+      // Rows are now [rowPos[row], rowPos[row + 1]). Sort each of them and
+      // slide the unique edges to the front of the array
+      unsigned numUnique = 0;
+      auto compactRow = [&](unsigned row) {
+        auto first = edges.begin() + rowPos[row];
+        auto last = edges.begin() + rowPos[row + 1];
+        std::sort(first, last);
+        last = std::unique(first, last);
+        auto newLast = std::copy(first, last, edges.begin() + numUnique);
+        numUnique = newLast - edges.begin();
+      };
+      std::vector<unsigned> rowBegin(numNodes + 1);
+      std::vector<unsigned> primaryEnd(numNodes);
+      for (NodeIndex n = 0; n < numNodes; ++n) {
+        rowBegin[n] = numUnique;
+        compactRow(2 * n);
+        primaryEnd[n] = numUnique;
+        compactRow(2 * n + 1);
+      }
+      rowBegin[numNodes] = numUnique;
+      edges.resize(numUnique);
+      edges.shrink_to_fit();
+      graph.edges.swap(edges);
+
+      for (NodeIndex n = 0; n < numNodes; ++n) {
+        CSRGraphNode node(n);
+        node.edgeBegin = graph.edges.data() + rowBegin[n];
+        node.numPrimary = primaryEnd[n] - rowBegin[n];
+        node.numEdges = rowBegin[n + 1] - rowBegin[n];
+        graph.nodes.push_back(node);
+        if (node.numEdges != 0)
+          graph.inGraph.set(n);
+      }
+      for (auto dst : graph.edges)
+        graph.inGraph.set(dst);
+
+      rowPos.clear();
+      rowPos.shrink_to_fit();
+    }
+  };
+
+  // Iterate over the nodes that are an endpoint of some edge
+  class node_iterator {
+  private:
+    const CSRGraph *graph;
+    int pos;
+
+  public:
+    node_iterator(const CSRGraph *g, int p) : graph(g), pos(p) {}
+
+    const CSRGraphNode &operator*() const { return graph->nodes[pos]; }
+    const CSRGraphNode *operator->() const { return &graph->nodes[pos]; }
+
+    bool operator==(const node_iterator &other) const {
+      return pos == other.pos;
+    }
+    bool operator!=(const node_iterator &other) const {
+      return !(*this == other);
+    }
+
+    node_iterator &operator++() {
+      pos = graph->inGraph.find_next(pos);
+      return *this;
+    }
+  };
+
+  CSRGraph() {}
+
+  // The node objects never move until the graph is rebuilt
+  CSRGraphNode *getNode(NodeIndex idx) {
+    assert(idx < nodes.size());
+    return &nodes[idx];
+  }
+  const CSRGraphNode *getNode(NodeIndex idx) const {
+    assert(idx < nodes.size());
+    return &nodes[idx];
+  }
+
+  bool isInGraph(NodeIndex idx) const { return inGraph.test(idx); }
+
+  unsigned getNumNodes() const { return nodes.size(); }
+  unsigned getNumEdges() const { return edges.size(); }
+
+  node_iterator node_begin() const {
+    return node_iterator(this, inGraph.find_first());
+  }
+  node_iterator node_end() const { return node_iterator(this, -1); }
+
+  void releaseMemory() {
+    nodes.clear();
+    nodes.shrink_to_fit();
+    edges.clear();
+    edges.shrink_to_fit();
+    inGraph.clear();
+  }
+};
+
+// Specialize the AnderGraphTraits for CSRGraph. This follows all the edges
+template <> class AndersGraphTraits<CSRGraph> {
+public:
+  typedef CSRGraphNode NodeType;
+  typedef CSRGraph::node_iterator NodeIterator;
+  typedef CSRGraphNode::iterator ChildIterator;
+
+  static inline ChildIterator child_begin(const NodeType *n) {
+    return n->begin();
+  }
+  static inline ChildIterator child_end(const NodeType *n) { return n->end(); }
+
+  static inline NodeIterator node_begin(const CSRGraph *g) {
+    return g->node_begin();
+  }
+  static inline NodeIterator node_end(const CSRGraph *g) {
+    return g->node_end();
+  }
+};
+
+#endif
@@ -113,6 +113,9 @@ protected:
     assert(sccStack.empty() && "sccStack not empty after cycle detection!");
   }
 
+  // The number of nodes visited so far, i.e. how much work has been done
+  unsigned getNumVisitedNodes() const { return timestamp; }
+
   void releaseSCCMemory() {
     dfsNum.clear();
     inComponent.clear();
@@ -0,0 +1,87 @@
+#ifndef ANDERSEN_HASHED_SPARSEBITVECTOR_H
+#define ANDERSEN_HASHED_SPARSEBITVECTOR_H
+
+#include "llvm/ADT/SparseBitVector.h"
+
+#include <cstddef>
+#include <cstdint>
+
+// A sparse bit vector that maintains a hash of its contents while it is being
+// built, so that hashing it is a constant time operation. This is what the
+// offline optimizers use as keys of their set-to-label maps.
+// The hash is the sum of a strong mix of every element. Summation makes the
+// hash independent of insertion order and lets insertions update it in O(1),
+// and the mixing keeps sets like {1, 2, 3} and {0} from colliding
+class HashedSparseBitVector {
+private:
+  llvm::SparseBitVector<> bitvec;
+  uint64_t hashValue;
+
+  // The splitmix64 finalizer. It maps 0 to a non-zero value, so the empty set
+  // and {0} get different hashes
+  static uint64_t mix(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+  }
+
+public:
+  using iterator = llvm::SparseBitVector<>::iterator;
+
+  HashedSparseBitVector() : hashValue(0) {}
+
+  // Return true if the set changes
+  bool insert(unsigned idx) {
+    if (!bitvec.test_and_set(idx))
+      return false;
+    hashValue += mix(idx);
+    return true;
+  }
+
+  // Return true if the set changes
+  bool unionWith(const HashedSparseBitVector &other) {
+    if (bitvec.empty()) {
+      bitvec = other.bitvec;
+      hashValue = other.hashValue;
+      return !bitvec.empty();
+    }
+    if (bitvec.contains(other.bitvec))
+      return false;
+
+    // Only the newly inserted elements contribute to the hash
+    for (auto idx : other.bitvec)
+      insert(idx);
+    return true;
+  }
+
+  void clear() {
+    bitvec.clear();
+    hashValue = 0;
+  }
+
+  bool empty() const { return bitvec.empty(); }
+
+  std::size_t getHash() const { return hashValue; }
+
+  const llvm::SparseBitVector<> &getBitVector() const { return bitvec; }
+
+  bool operator==(const HashedSparseBitVector &other) const {
+    return hashValue == other.hashValue && bitvec == other.bitvec;
+  }
+  bool operator!=(const HashedSparseBitVector &other) const {
+    return !(*this == other);
+  }
+
+  iterator begin() const { return bitvec.begin(); }
+  iterator end() const { return bitvec.end(); }
+};
+
+// Hasher for using HashedSparseBitVector as keys of std::unordered_map
+struct HashedSparseBitVectorHash {
+  std::size_t operator()(const HashedSparseBitVector &vec) const {
+    return vec.getHash();
+  }
+};
+
+#endif
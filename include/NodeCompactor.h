@@ -0,0 +1,67 @@
+#ifndef ANDERSEN_NODE_COMPACTOR_H
+#define ANDERSEN_NODE_COMPACTOR_H
+
+#include "Constraint.h"
+#include "NodeFactory.h"
+#include "PtsSet.h"
+
+#include "llvm/ADT/DenseMap.h"
+
+#include <map>
+#include <vector>
+
+// After the offline optimizations, most nodes are merged into others, and the
+// representatives that are left are scattered all over the node factory. The
+// NodeCompactor renumbers the nodes the solver needs into a node factory of
+// their own, so that they are dense and related nodes sit close together:
+// - Every object node comes first, in order, so that object ids stay the same
+// and points-to sets need no translating.
+// - The representatives the constraints refer to follow, in the breadth-first
+// order of the edges between them, starting from each constraint in turn.
+// If only the objects the constraints mention are wanted (as for a part of
+// the constraints), only those come first, after the special nodes,
+// and mapBack() translates the points-to sets.
+// The original node factory is only read until mapBack(), so the IR
+// maintenance interfaces may keep using it while the solver runs.
+class AndersNodeCompactor {
+private:
+  AndersNodeFactory &nodeFactory;
+  AndersNodeFactory compactFactory;
+  // Whether every object of nodeFactory gets a compact node, or only the
+  // special ones and the ones the constraints mention
+  bool allObjects;
+  // Map from a compact node to the original node it stands for
+  std::vector<NodeIndex> origNodes;
+  // Map from an original representative (or object) to its compact node
+  llvm::DenseMap<NodeIndex, NodeIndex> compactNodes;
+
+  void numberObjects(const std::vector<AndersConstraint> &constraints);
+  void numberPointers(const std::vector<AndersConstraint> &constraints);
+
+public:
+  AndersNodeCompactor(AndersNodeFactory &n, bool allObjects = true)
+      : nodeFactory(n), allObjects(allObjects) {}
+
+  // Renumber the nodes constraints refer to, and rewrite constraints in terms
+  // of the compact nodes
+  void run(std::vector<AndersConstraint> &constraints);
+
+  // The node factory the compact nodes live in. The solver merges nodes here
+  AndersNodeFactory &getCompactFactory() { return compactFactory; }
+
+  // Return the compact node of the representative of orig, or InvalidIndex
+  // if it has none
+  NodeIndex getCompactNode(NodeIndex orig) const;
+  // The same, but give the representative a compact node if it has none
+  NodeIndex getOrCreateCompactNode(NodeIndex orig);
+  NodeIndex getOriginalNode(NodeIndex compact) const {
+    assert(compact < origNodes.size() && "Compact node out of range!");
+    return origNodes[compact];
+  }
+
+  // Carry the merges done in the compact factory over to the original one,
+  // and key ptsGraph by the original representatives again
+  void mapBack(std::map<NodeIndex, AndersPtsSet> &ptsGraph);
+};
+
+#endif
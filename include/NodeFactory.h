@@ -1,61 +1,57 @@
 #ifndef ANDERSEN_NODE_FACTORY_H
 #define ANDERSEN_NODE_FACTORY_H
 
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/BitVector.h"
 #include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/DataLayout.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/Value.h"
 
+#include <algorithm>
+#include <cassert>
 #include <vector>
 
-// AndersNode class - This class is used to represent a node in the constraint
-// graph.  Due to various optimizations, it is not always the case that there is
-// always a mapping from a Node to a Value. (In particular, we add artificial
-// Node's that represent the set of pointed-to variables shared for each
-// location equivalent Node. Ordinary clients are not allowed to create
-// AndersNode objects. To guarantee index consistency, AndersNodes (and its
-// subclasses) instances should only be created through AndersNodeFactory.
+// A node in the constraint graph. Due to various optimizations, it is not
+// always the case that there is always a mapping from a Node to a Value. (In
+// particular, we add artificial Node's that represent the set of pointed-to
+// variables shared for each location equivalent Node. Ordinary clients are not
+// allowed to create nodes. To guarantee index consistency, nodes should only be
+// created through AndersNodeFactory, which represents them with plain indices.
 typedef unsigned NodeIndex;
-class AndersNode {
-public:
-  enum AndersNodeType { VALUE_NODE, OBJ_NODE };
-
-private:
-  AndersNodeType type;
-  NodeIndex idx, mergeTarget;
-  const llvm::Value *value;
-  AndersNode(AndersNodeType t, unsigned i, const llvm::Value *v = nullptr)
-      : type(t), idx(i), mergeTarget(i), value(v) {}
-
-public:
-  NodeIndex getIndex() const { return idx; }
-  const llvm::Value *getValue() const { return value; }
 
-  friend class AndersNodeFactory;
-};
-
-// This is the factory class of AndersNode
-// It use a vectors to hold all Nodes in the program
-// Since vectors may invalidate all element pointers/iterators when resizing, it
-// is impossible to return AndersNode* in public interfaces without using
-// std::unique_ptr and heap allocations. Therefore, we use plain integers to
-// represent nodes for public functions like createXXX and getXXX. This is ugly,
-// but it is efficient.
+// This is the factory class of nodes
+// It keeps the fields of the nodes in parallel arrays indexed by NodeIndex,
+// since the hottest loops of the analysis (following merge targets and
+// checking node types) each need a single field, and shouldn't have to drag
+// the others through the cache. Therefore, we use plain integers to represent
+// nodes for public functions like createXXX and getXXX. This is ugly, but it
+// is efficient.
 class AndersNodeFactory {
 public:
   // The largest unsigned int is reserved for invalid index
   static const unsigned InvalidIndex;
 
 private:
-  // The set of nodes
-  std::vector<AndersNode> nodes;
+  // The set of nodes. Node i is an object node iff bit i of objNodeBits is
+  // set, its merge target is mergeTargets[i], and its value is nodeValues[i]
+  llvm::BitVector objNodeBits;
+  std::vector<NodeIndex> mergeTargets;
+  std::vector<const llvm::Value *> nodeValues;
+
+  // objNodes - The object nodes, in creation order. The position of an object
+  // node in this vector is its object id. It is sorted, since nodes are
+  // created in index order too
+  std::vector<NodeIndex> objNodes;
 
   // Some special indices
   static const NodeIndex UniversalPtrIndex = 0;
   static const NodeIndex UniversalObjIndex = 1;
   static const NodeIndex NullPtrIndex = 2;
   static const NodeIndex NullObjectIndex = 3;
+  static const NodeIndex UniversalObjId = 0;
 
   // valueNodeMap - This map indicates the AndersNode* that a particular Value*
   // corresponds to
@@ -77,9 +73,37 @@ private:
   // take variable arguments.
   llvm::DenseMap<const llvm::Function *, NodeIndex> varargMap;
 
+  // locEquivMap - Objects that always appear together in points-to sets
+  // (location equivalence) are represented by a single object node in those
+  // sets. This map contains an entry for each such representative, listing the
+  // other objects it stands for.
+  llvm::DenseMap<NodeIndex, std::vector<NodeIndex>> locEquivMap;
+
+  // objCopyMap - Values that copyValue() mapped to an existing object node.
+  // When the value of such a node is removed, one of them takes its place
+  llvm::DenseMap<NodeIndex, std::vector<const llvm::Value *>> objCopyMap;
+  // copiedReps - Representatives that copyValue() merged the value node of a
+  // clone into. The clone and its origin are different values at run time
+  // (e.g. two inlined copies of one alloca), even though they share the node
+  llvm::DenseSet<NodeIndex> copiedReps;
+
+  // Clear the value of node idx if it is oldVal, or hand the node over to
+  // newVal. A null newVal lets a copy of the object take over, if any
+  void releaseNode(NodeIndex idx, const llvm::Value *oldVal,
+                   const llvm::Value *newVal);
+
+  // Append a node for val. Object nodes get the next object id
+  NodeIndex pushNode(bool isObj, const llvm::Value *val);
+  // Point every node on the way from n to its merge target right at it
+  NodeIndex compressPath(NodeIndex n);
+
 public:
   AndersNodeFactory();
 
+  // Make room for numNodes nodes in total, so that the node table doesn't
+  // have to grow while they are created
+  void reserve(unsigned numNodes);
+
   // Factory methods
   NodeIndex createValueNode(const llvm::Value *val = nullptr);
   NodeIndex createObjectNode(const llvm::Value *val = nullptr);
@@ -95,36 +119,107 @@ public:
   NodeIndex getVarargNodeFor(const llvm::Function *f) const;
 
   // Node merge interfaces
-  void mergeNode(NodeIndex n0, NodeIndex n1); // Merge n1 into n0
-  NodeIndex getMergeTarget(NodeIndex n);
-  NodeIndex getMergeTarget(NodeIndex n) const;
+  void mergeNode(NodeIndex n0, NodeIndex n1) { // Merge n1 into n0
+    assert(n0 < getNumNodes() && n1 < getNumNodes());
+    mergeTargets[n1] = n0;
+  }
+  NodeIndex getMergeTarget(NodeIndex n) {
+    assert(n < getNumNodes());
+    // Most nodes are either representatives or merged right into one
+    NodeIndex ret = mergeTargets[n];
+    if (mergeTargets[ret] == ret)
+      return ret;
+    return compressPath(n);
+  }
+  NodeIndex getMergeTarget(NodeIndex n) const {
+    assert(n < getNumNodes());
+    NodeIndex ret = mergeTargets[n];
+    while (ret != mergeTargets[ret])
+      ret = mergeTargets[ret];
+    return ret;
+  }
+  // Point every node directly at its merge target, so that the const
+  // getMergeTarget() takes a single step
+  void flattenMergeTargets();
+
+  // Location equivalence interfaces
+  void mergeLocation(NodeIndex n0, NodeIndex n1); // Let n0 stand for n1
+  // Return the objects (other than n itself) that n stands for
+  llvm::ArrayRef<NodeIndex> getLocationEquivalents(NodeIndex n) const {
+    auto itr = locEquivMap.find(n);
+    if (itr == locEquivMap.end())
+      return llvm::None;
+    return itr->second;
+  }
 
   // Pointer arithmetic
   bool isObjectNode(NodeIndex i) const {
-    return (nodes.at(i).type == AndersNode::OBJ_NODE);
+    assert(i < getNumNodes() && "Node index out of range!");
+    return objNodeBits[i];
   }
   NodeIndex getOffsetObjectNode(NodeIndex n, unsigned offset) const {
     assert(isObjectNode(n + offset));
     return n + offset;
   }
 
+  // Object ids number the object nodes densely from 0, in the order the nodes
+  // were created, so the ids of two objects compare the same way their node
+  // indices do. The solver keeps points-to sets over object ids
+  NodeIndex getObjectId(NodeIndex n) const {
+    assert(isObjectNode(n) && "Not an object node!");
+    return std::lower_bound(objNodes.begin(), objNodes.end(), n) -
+           objNodes.begin();
+  }
+  NodeIndex getObjectNodeWithId(NodeIndex id) const {
+    assert(id < objNodes.size() && "Object id out of range!");
+    return objNodes[id];
+  }
+  llvm::ArrayRef<NodeIndex> getObjectNodes() const { return objNodes; }
+
   // Special node getters
   NodeIndex getUniversalPtrNode() const { return UniversalPtrIndex; }
   NodeIndex getUniversalObjNode() const { return UniversalObjIndex; }
   NodeIndex getNullPtrNode() const { return NullPtrIndex; }
   NodeIndex getNullObjectNode() const { return NullObjectIndex; }
+  // The universal object has the smallest object id of all
+  NodeIndex getUniversalObjId() const { return UniversalObjId; }
 
   // Value getters
   const llvm::Value *getValueForNode(NodeIndex i) const {
-    return nodes.at(i).getValue();
+    assert(i < getNumNodes() && "Node index out of range!");
+    return nodeValues[i];
   }
   void getAllocSites(std::vector<const llvm::Value *> &) const;
 
   // Value remover
   void removeNodeForValue(const llvm::Value *val) { valueNodeMap.erase(val); }
 
+  // Value maintenance interfaces. They keep the maps in sync with IR changes
+  // made after the analysis has run, without touching any points-to set
+  // Let newVal take over the nodes of oldVal, unless it has its own already.
+  // Either way, oldVal drops out of the maps
+  void replaceValue(const llvm::Value *oldVal, const llvm::Value *newVal);
+  // Let the clone to share the nodes of from: it gets a value node merged
+  // into the representative of from, and stands for the same object
+  void copyValue(const llvm::Value *from, const llvm::Value *to);
+  // Return true if the representative of value node n stands for clones made
+  // by copyValue(), so that not all the values it stands for are the same
+  bool hasValueCopies(NodeIndex n) const {
+    return copiedReps.count(getMergeTarget(n));
+  }
+  // Return true if object node n stands for more than one allocation, since
+  // copyValue() has mapped clones of its value to it
+  bool hasObjectCopies(NodeIndex n) const { return objCopyMap.count(n); }
+  // Let val drop out of the maps
+  void removeValue(const llvm::Value *val);
+  // Return true if any of the maps has an entry for val
+  bool hasNodesFor(const llvm::Value *val) const;
+  // Put every value the maps have an entry for into the first argument
+  void getMappedValues(std::vector<const llvm::Value *> &) const;
+
   // Size getters
-  unsigned getNumNodes() const { return nodes.size(); }
+  unsigned getNumNodes() const { return mergeTargets.size(); }
+  unsigned getNumObjects() const { return objNodes.size(); }
 
   // For debugging purpose
   void dumpNode(NodeIndex) const;
@@ -0,0 +1,151 @@
+#ifndef ANDERSEN_OFFLINE_CONSTRAINT_GRAPH_H
+#define ANDERSEN_OFFLINE_CONSTRAINT_GRAPH_H
+
+#include "CSRGraph.h"
+#include "Constraint.h"
+#include "GraphTraits.h"
+#include "NodeFactory.h"
+
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/DenseMap.h"
+
+#include <vector>
+
+// The offline constraint graph. It is built once from the constraints and
+// shared by all the offline passes (HVN, HU and the offline part of HCD). For
+// each of the N nodes in the node factory, the graph has a VAR node (the node
+// itself), a REF node (standing for *n, with index n + N) and an ADR node
+// (standing for &n, with index n + 2N). The REF and ADR nodes don't exist in
+// the node factory.
+// Edges go from a node to its predecessors, and are kept in a CSRGraph:
+// - The primary edges come from copy, load and store constraints. Every
+// offline pass follows them.
+// - The secondary edges are the ones only the offline variable substitution
+// passes (HVN and HU) follow: the edges from addr-of constraints, and the
+// implicit edges that help them capture more cycles. I.E for the constraint
+// a = &b we add *a = b, and for a = b we add *a = *b. These implicit edges
+// relate the union of the contents of everything a points to, which is not
+// what HCD means by *a, so HCD must not see them.
+// The CSRGraph is never modified. Passes merge nodes through the node factory,
+// and record that a pointer points to a single object (setUniquePointee()) or
+// to nothing (setNoPointee()). updateMerges() then rebuilds the CSRGraph from
+// itself with every edge redirected to the merge targets of its endpoints,
+// which is much cheaper than building it from the constraints again. Each pass
+// collapses its own cycles on top of that.
+class OfflineConstraintGraph {
+private:
+  AndersNodeFactory &nodeFactory;
+  // The number of nodes in the node factory when the graph is built
+  unsigned numNodes;
+  bool built;
+  // Whether some pointer facts are not reflected in the graph yet
+  bool stale;
+
+  CSRGraph graph;
+  // VAR nodes whose address is taken
+  llvm::BitVector addrTakenNodes;
+  // VAR nodes whose merges are reflected in the graph
+  llvm::BitVector foldedNodes;
+  // Map from a pointer to the only object it can point to
+  llvm::DenseMap<NodeIndex, NodeIndex> uniquePointee;
+  // Pointers that point to nothing
+  llvm::BitVector noPointee;
+
+  bool isEmptyRefNode(NodeIndex n) const {
+    return isRefNode(n) && noPointee.test(n - numNodes);
+  }
+  void addEdge(CSRGraph::Builder &, NodeIndex node, NodeIndex pred,
+               bool isExtra);
+  void addConstraintEdges(CSRGraph::Builder &,
+                          const std::vector<AndersConstraint> &);
+  void addGraphEdges(CSRGraph::Builder &);
+  void printNode(llvm::raw_ostream &, NodeIndex) const;
+
+public:
+  OfflineConstraintGraph(AndersNodeFactory &n)
+      : nodeFactory(n), numNodes(0), built(false), stale(false) {}
+
+  // (Re)build the graph from the constraints
+  void build(const std::vector<AndersConstraint> &constraints);
+  bool isBuilt() const { return built; }
+
+  // Bring the graph up to date with the nodes merged in the node factory and
+  // the pointer facts recorded since the last call
+  void updateMerges();
+  // Record that ptr (which must be a representative) points to obj and nothing
+  // else, so *ptr is obj
+  void setUniquePointee(NodeIndex ptr, NodeIndex obj);
+  // Record that ptr (which must be a representative) points to nothing, so
+  // *ptr contributes nothing to anyone
+  void setNoPointee(NodeIndex ptr);
+
+  NodeIndex getRefNodeIndex(NodeIndex n) const {
+    assert(n < numNodes);
+    return n + numNodes;
+  }
+  NodeIndex getAdrNodeIndex(NodeIndex n) const {
+    assert(n < numNodes);
+    return n + 2 * numNodes;
+  }
+  bool isVarNode(NodeIndex n) const { return n < numNodes; }
+  bool isRefNode(NodeIndex n) const {
+    return n >= numNodes && n < 2 * numNodes;
+  }
+  bool isAdrNode(NodeIndex n) const { return n >= 2 * numNodes; }
+
+  // Size of the VAR/REF/ADR index space
+  unsigned getSize() const { return 3 * numNodes; }
+
+  // The node n has been folded into. VAR nodes follow the node factory, REF
+  // nodes follow their pointers and ADR nodes never get merged
+  NodeIndex getMergeTarget(NodeIndex n);
+
+  CSRGraphNode *getNode(NodeIndex n) { return graph.getNode(n); }
+
+  const llvm::BitVector &getAddrTakenNodes() const { return addrTakenNodes; }
+
+  CSRGraph::node_iterator node_begin() const { return graph.node_begin(); }
+  CSRGraph::node_iterator node_end() const { return graph.node_end(); }
+
+  void releaseMemory();
+
+  // For debugging
+  void dump() const;
+  void writeToDotFile(const char *fileName) const;
+};
+
+// The cycle detectors look at the offline graph through one of these views.
+// HVN and HU follow all the edges while HCD only follows the primary edges
+template <bool WithExtraEdges> class OfflineGraphView {
+private:
+  OfflineConstraintGraph &graph;
+
+public:
+  explicit OfflineGraphView(OfflineConstraintGraph &g) : graph(g) {}
+
+  OfflineConstraintGraph &getGraph() const { return graph; }
+};
+
+// Specialize the AnderGraphTraits for the views of OfflineConstraintGraph
+template <bool WithExtraEdges>
+class AndersGraphTraits<OfflineGraphView<WithExtraEdges>> {
+public:
+  typedef CSRGraphNode NodeType;
+  typedef CSRGraph::node_iterator NodeIterator;
+  typedef CSRGraphNode::iterator ChildIterator;
+
+  static inline ChildIterator child_begin(NodeType *n) { return n->begin(); }
+  static inline ChildIterator child_end(NodeType *n) {
+    return WithExtraEdges ? n->end() : n->primary_end();
+  }
+
+  static inline NodeIterator
+  node_begin(OfflineGraphView<WithExtraEdges> *view) {
+    return view->getGraph().node_begin();
+  }
+  static inline NodeIterator node_end(OfflineGraphView<WithExtraEdges> *view) {
+    return view->getGraph().node_end();
+  }
+};
+
+#endif
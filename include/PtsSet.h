@@ -17,12 +17,14 @@ public:
   // This function should be marked const, but we cannot do it because
   // SparseBitVector::test() is not marked const. WHY???
   bool has(unsigned idx) { return bitvec.test(idx); }
+  // SparseBitVector::test() moves a cursor inside the bit vector, so the
+  // non-const has() is not safe to call from several threads at once. This one
+  // leaves *this alone: it intersects the element list with a single element
+  // instead, which doesn't copy *this the way contains() would
   bool has(unsigned idx) const {
-    // Since llvm::SparseBitVector::test() does not have a const quantifier, we
-    // have to use this ugly workaround to implement has()
     llvm::SparseBitVector<> idVec;
     idVec.set(idx);
-    return bitvec.contains(idVec);
+    return bitvec.intersects(idVec);
   }
 
   // Return true if the ptsset changes
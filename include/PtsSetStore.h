@@ -0,0 +1,157 @@
+#ifndef ANDERSEN_PTSSET_STORE_H
+#define ANDERSEN_PTSSET_STORE_H
+
+#include "NodeFactory.h"
+#include "PtsSet.h"
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/Hashing.h"
+#include "llvm/ADT/SmallVector.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <vector>
+
+// A read-only store of points-to sets, meant for the solution once solving is
+// done. Every distinct set is stored once and gets a set id in
+// [0, getNumSets()), so two sets are equal iff their ids are. The elements of
+// all sets are stored sorted in one array, and set i owns a slice of it.
+class AndersPtsSetStore {
+private:
+  std::vector<NodeIndex> elements;
+  // Set i is [elements[offsets[i]], elements[offsets[i + 1]])
+  std::vector<unsigned> offsets;
+
+  // Return true if sorted a and b share an element other than idx
+  static bool intersectSorted(llvm::ArrayRef<NodeIndex> a,
+                              llvm::ArrayRef<NodeIndex> b, NodeIndex idx) {
+    if (a.size() > b.size())
+      std::swap(a, b);
+    if (a.empty() || a.back() < b.front() || b.back() < a.front())
+      return false;
+
+    // Look the elements of a much smaller set up instead of walking both
+    if (a.size() * 16 < b.size()) {
+      auto pos = b.begin();
+      for (auto elem : a) {
+        pos = std::lower_bound(pos, b.end(), elem);
+        if (pos == b.end())
+          return false;
+        if (*pos == elem && elem != idx)
+          return true;
+      }
+      return false;
+    }
+
+    auto itr1 = a.begin(), ite1 = a.end();
+    auto itr2 = b.begin(), ite2 = b.end();
+    while (itr1 != ite1 && itr2 != ite2) {
+      if (*itr1 < *itr2)
+        ++itr1;
+      else if (*itr2 < *itr1)
+        ++itr2;
+      else {
+        if (*itr1 != idx)
+          return true;
+        ++itr1;
+        ++itr2;
+      }
+    }
+    return false;
+  }
+
+public:
+  // Add the sets with addSet(), then hand the store out with finish()
+  class Builder {
+  private:
+    std::vector<NodeIndex> elements;
+    std::vector<unsigned> offsets;
+    // The ids of the sets added so far, by the hash of their elements
+    llvm::DenseMap<std::size_t, llvm::SmallVector<unsigned, 1>> setIdsByHash;
+
+  public:
+    Builder() : offsets(1, 0) {}
+
+    // Return the id of set. Adding a set equal to one added before returns
+    // the same id
+    unsigned addSet(const AndersPtsSet &set) {
+      unsigned first = elements.size();
+      for (auto elem : set)
+        elements.push_back(elem);
+      return addLastSet(first);
+    }
+    // The same, for a set whose elements are positions in elemMap, which must
+    // be sorted. The set gets stored as the elemMap entries they refer to
+    unsigned addSet(const AndersPtsSet &set,
+                    llvm::ArrayRef<NodeIndex> elemMap) {
+      unsigned first = elements.size();
+      for (auto elem : set)
+        elements.push_back(elemMap[elem]);
+      return addLastSet(first);
+    }
+
+  private:
+    // Take the elements from first on as a new set, or take them back out if
+    // the set turns out to be a duplicate
+    unsigned addLastSet(unsigned first) {
+      llvm::ArrayRef<NodeIndex> newSet(elements.data() + first,
+                                       elements.size() - first);
+
+      auto &bucket = setIdsByHash[llvm::hash_combine_range(newSet.begin(),
+                                                           newSet.end())];
+      for (auto id : bucket) {
+        llvm::ArrayRef<NodeIndex> oldSet(elements.data() + offsets[id],
+                                         offsets[id + 1] - offsets[id]);
+        if (oldSet == newSet) {
+          elements.resize(first);
+          return id;
+        }
+      }
+
+      unsigned id = offsets.size() - 1;
+      offsets.push_back(elements.size());
+      bucket.push_back(id);
+      return id;
+    }
+
+  public:
+    void finish(AndersPtsSetStore &store) {
+      elements.shrink_to_fit();
+      offsets.shrink_to_fit();
+      store.elements.swap(elements);
+      store.offsets.swap(offsets);
+      elements.clear();
+      offsets.assign(1, 0);
+      setIdsByHash.clear();
+    }
+  };
+
+  AndersPtsSetStore() : offsets(1, 0) {}
+
+  unsigned getNumSets() const { return offsets.size() - 1; }
+  unsigned getNumElements() const { return elements.size(); }
+
+  // The elements of set id, sorted. The slice stays valid as long as the
+  // store does
+  llvm::ArrayRef<NodeIndex> getSet(unsigned id) const {
+    assert(id < getNumSets() && "Set id out of range!");
+    return llvm::ArrayRef<NodeIndex>(elements.data() + offsets[id],
+                                     offsets[id + 1] - offsets[id]);
+  }
+
+  // Return true if the sorted sets a and b share an element
+  static bool intersectWith(llvm::ArrayRef<NodeIndex> a,
+                            llvm::ArrayRef<NodeIndex> b) {
+    return intersectSorted(a, b, AndersNodeFactory::InvalidIndex);
+  }
+  // Return true if the sorted sets a and b share an element other than idx
+  static bool intersectWithExcept(llvm::ArrayRef<NodeIndex> a,
+                                  llvm::ArrayRef<NodeIndex> b,
+                                  NodeIndex idx) {
+    return intersectSorted(a, b, idx);
+  }
+};
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef ANDERSEN_UNIFICATION_H
+#define ANDERSEN_UNIFICATION_H
+
+#include "Constraint.h"
+#include "NodeFactory.h"
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+
+#include <utility>
+#include <vector>
+
+// A unification based points-to analysis (Steensgaard's) over the same
+// constraints the inclusion solver takes. Instead of letting a pointer point
+// to a subset of what another one does, it lets them point to the same class
+// of locations, so every constraint is looked at once and the whole run is
+// almost linear. Its points-to sets are supersets of the ones the inclusion
+// solver finds, which makes it both a cheap (if coarse) result of its own and
+// a bound the offline optimizations can rely on.
+// Locations are unified here rather than in the node factory: merging nodes
+// there means that their points-to sets are the same, which is implied by,
+// but doesn't imply, their objects being in the same class.
+class AndersUnifier {
+private:
+  const AndersNodeFactory &nodeFactory;
+
+  // The location classes, as a union-find forest. The first elements are the
+  // nodes of the factory, where an object node stands for its object. The
+  // ones after them are classes of locations that no object is known to be
+  // in yet
+  std::vector<unsigned> parents;
+  std::vector<unsigned char> ranks;
+  // Map from a class leader to the class its locations point to, or
+  // InvalidIndex if they point to nothing yet
+  std::vector<unsigned> pointees;
+  // Map from a class leader to the objects in the class whose addresses are
+  // taken. No other object shows up in any points-to set. The objects are in
+  // node index order, so that they are in object id order as well
+  llvm::DenseMap<unsigned, std::vector<NodeIndex>> classObjects;
+  // Map from a class leader to the classes that loads through pointers to it
+  // load into. A load through a pointer that may point to anything may load
+  // anything (see solveConstraintSet()), so once the class has the universal
+  // object, they get it too. The class of the universal object has no entry
+  llvm::DenseMap<unsigned, std::vector<unsigned>> loadTargets;
+  // The pairs of classes unify() still has to join
+  std::vector<std::pair<unsigned, unsigned>> pendingUnions;
+
+  unsigned find(unsigned elem);
+  // Return the class elem points to, making up one if there is none
+  unsigned getPointee(unsigned elem);
+  // Join the classes of elem0 and elem1, and what they point to
+  void unify(unsigned elem0, unsigned elem1);
+  // Let a load through a pointer to the class of ptrElem load into the class
+  // of targetElem
+  void addLoadTarget(unsigned ptrElem, unsigned targetElem);
+
+public:
+  AndersUnifier(const AndersNodeFactory &n) : nodeFactory(n) {}
+
+  // Unify the locations according to constraints. The nodes that are merged
+  // in the node factory are taken to have the same points-to set
+  void run(const std::vector<AndersConstraint> &constraints);
+
+  // Return the class of the objects node n may point to, or InvalidIndex if
+  // it points to nothing. Nodes with the same class have the same set
+  unsigned getPointeeClass(NodeIndex n) const;
+  // Return the objects node n may point to, in object id order
+  llvm::ArrayRef<NodeIndex> getPointees(NodeIndex n) const;
+};
+
+#endif
@@ -1,10 +1,14 @@
 #include "Andersen.h"
+#include "OfflineConstraintGraph.h"
 
+#include "llvm/ADT/Hashing.h"
 #include "llvm/ADT/Statistic.h"
 #include "llvm/IR/Module.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/raw_ostream.h"
 
+#include <chrono>
+
 using namespace llvm;
 
 cl::opt<bool> DumpDebugInfo("dump-debug",
@@ -17,15 +21,26 @@ cl::opt<bool> DumpConstraintInfo("dump-cons",
                                  cl::desc("Dump constraint info into stderr"),
                                  cl::init(false), cl::Hidden);
 
-Andersen::Andersen(const Module &module) { runOnModule(module); }
+Andersen::Andersen(const Module &module, bool async)
+    : pointedByBuilt(false), frozen(false), valueEpoch(0) {
+  runOnModule(module, async);
+}
+
+Andersen::~Andersen() {
+  // The background solve refers to this
+  if (pendingSolve.valid())
+    pendingSolve.wait();
+}
 
 void Andersen::getAllAllocationSites(
     std::vector<const llvm::Value *> &allocSites) const {
+  waitForSolve();
   nodeFactory.getAllocSites(allocSites);
 }
 
 bool Andersen::getPointsToSet(const llvm::Value *v,
                               std::vector<const llvm::Value *> &ptsSet) const {
+  waitForSolve();
   NodeIndex ptrIndex = nodeFactory.getValueNodeFor(v);
   // We have no idea what v is...
   if (ptrIndex == AndersNodeFactory::InvalidIndex ||
@@ -35,36 +50,243 @@ bool Andersen::getPointsToSet(const llvm::Value *v,
   NodeIndex ptrTgt = nodeFactory.getMergeTarget(ptrIndex);
   ptsSet.clear();
 
-  auto ptsItr = ptsGraph.find(ptrTgt);
-  if (ptsItr == ptsGraph.end()) {
+  const AndersPtsSetFacts *facts = getPtsSetFacts(ptrTgt);
+  if (facts == nullptr) {
     // Can't find ptrTgt. The reason might be that ptrTgt is an undefined
     // pointer. Dereferencing it is undefined behavior anyway, so we might just
     // want to treat it as a nullptr pointer
     return true;
   }
-  for (auto v : ptsItr->second) {
+  // The universal object stands for everything
+  if (facts->hasUniversalObj)
+    return false;
+  for (auto v : facts->elements) {
     if (v == nodeFactory.getNullObjectNode())
       continue;
 
     const llvm::Value *val = nodeFactory.getValueForNode(v);
     if (val != nullptr)
       ptsSet.push_back(val);
+
+    // v may stand for other location equivalent objects
+    for (auto equiv : nodeFactory.getLocationEquivalents(v)) {
+      if (const llvm::Value *equivVal = nodeFactory.getValueForNode(equiv))
+        ptsSet.push_back(equivVal);
+    }
+  }
+  return true;
+}
+
+void Andersen::freeze() {
+  waitForSolve();
+  // The IR maintenance interfaces may have merged new nodes and dropped the
+  // pointedBy index since the last call, so redo both
+
+  // The const getMergeTarget() doesn't compress paths, so make every path a
+  // single step instead
+  nodeFactory.flattenMergeTargets();
+  if (!pointedByBuilt)
+    buildPointedByIndex();
+  frozen = true;
+}
+
+bool Andersen::getPointsToSetView(const llvm::Value *v,
+                                  AndersPtsSetView &view) const {
+  waitForSolve();
+  NodeIndex ptrIndex = nodeFactory.getValueNodeFor(v);
+  // We have no idea what v is...
+  if (ptrIndex == AndersNodeFactory::InvalidIndex ||
+      ptrIndex == nodeFactory.getUniversalPtrNode())
+    return false;
+
+  NodeIndex ptrTgt = nodeFactory.getMergeTarget(ptrIndex);
+  const AndersPtsSetFacts *facts = getPtsSetFacts(ptrTgt);
+  if (facts && facts->hasUniversalObj)
+    return false;
+  // Treat a pointer without a points-to set as a nullptr pointer, the same
+  // way getPointsToSet() does
+  view = AndersPtsSetView(facts ? facts : &ptsSetFacts[EmptySetId]);
+  return true;
+}
+
+bool Andersen::isConstantMemoryNode(NodeIndex idx) const {
+  if (const Value *val = nodeFactory.getValueForNode(idx))
+    return isa<GlobalValue>(val) && (!isa<GlobalVariable>(val) ||
+                                     cast<GlobalVariable>(val)->isConstant());
+  return idx == nodeFactory.getNullObjectNode();
+}
+
+// Map an element to its bit in a points-to set signature. The multiplier
+// spreads the nearby indices that objects allocated together get
+static inline uint64_t getSignatureBit(NodeIndex idx) {
+  return uint64_t(1) << ((idx * 0x9e3779b97f4a7c15ULL) >> 58);
+}
+
+AndersPtsSetFacts Andersen::computePtsSetFacts(unsigned setId) const {
+  ArrayRef<NodeIndex> set = ptsSetStore.getSet(setId);
+  AndersPtsSetFacts facts;
+  facts.elements = set;
+  facts.setId = setId;
+  facts.fingerprint = hash_combine_range(set.begin(), set.end());
+  facts.size = set.size();
+  facts.singleElement =
+      facts.size == 1 ? *set.begin() : AndersNodeFactory::InvalidIndex;
+  facts.isNullOnly = facts.singleElement == nodeFactory.getNullObjectNode();
+  facts.signature = 0;
+  facts.hasUniversalObj = false;
+  facts.isConstantMemory = true;
+  for (auto idx : set) {
+    if (idx != nodeFactory.getNullObjectNode())
+      facts.signature |= getSignatureBit(idx);
+    if (idx == nodeFactory.getUniversalObjNode())
+      facts.hasUniversalObj = true;
+    if (!facts.isConstantMemory)
+      continue;
+    if (!isConstantMemoryNode(idx))
+      facts.isConstantMemory = false;
+    for (auto equiv : nodeFactory.getLocationEquivalents(idx))
+      if (!isConstantMemoryNode(equiv))
+        facts.isConstantMemory = false;
+  }
+  return facts;
+}
+
+void Andersen::buildPointedByIndex() const {
+  unsigned numNodes = nodeFactory.getNumNodes();
+
+  // Both graphs are built in two passes over the same edges
+  CSRGraph::Builder pointedByBuilder(numNodes);
+  auto addPointedByEdges = [this, &pointedByBuilder]() {
+    for (auto const &mapping : repSetIds)
+      for (auto obj : ptsSetStore.getSet(mapping.second))
+        pointedByBuilder.addEdge(obj, mapping.first);
+  };
+  addPointedByEdges();
+  pointedByBuilder.startFilling();
+  addPointedByEdges();
+  pointedByBuilder.finish(pointedByGraph);
+
+  // Only the value nodes that getValueNodeFor() maps a Value to are pointers
+  // the clients can see. Return and vararg nodes carry the Value of their
+  // function as well
+  CSRGraph::Builder memberBuilder(numNodes);
+  auto addMemberEdges = [this, numNodes, &memberBuilder]() {
+    for (NodeIndex i = 0; i < numNodes; ++i) {
+      if (nodeFactory.isObjectNode(i))
+        continue;
+      const Value *val = nodeFactory.getValueForNode(i);
+      if (val && nodeFactory.getValueNodeFor(val) == i)
+        memberBuilder.addEdge(nodeFactory.getMergeTarget(i), i);
+    }
+  };
+  addMemberEdges();
+  memberBuilder.startFilling();
+  addMemberEdges();
+  memberBuilder.finish(repMemberGraph);
+
+  for (NodeIndex i = 0; i < numNodes; ++i) {
+    for (auto equiv : nodeFactory.getLocationEquivalents(i))
+      locEquivRep[equiv] = i;
+  }
+
+  pointedByBuilt = true;
+}
+
+bool Andersen::getPointedBy(const llvm::Value *alloc,
+                            std::vector<const llvm::Value *> &ptrs) const {
+  waitForSolve();
+  NodeIndex obj = nodeFactory.getObjectNodeFor(alloc);
+  if (obj == AndersNodeFactory::InvalidIndex)
+    return false;
+
+  if (!pointedByBuilt)
+    buildPointedByIndex();
+  ptrs.clear();
+
+  // A location equivalent object only shows up in points-to sets through the
+  // object that stands for it
+  auto itr = locEquivRep.find(obj);
+  if (itr != locEquivRep.end())
+    obj = itr->second;
+
+  // The representatives pointing to obj and those pointing to anything are
+  // both sorted, so merge them without duplicates
+  const CSRGraphNode *objNode = pointedByGraph.getNode(obj);
+  const CSRGraphNode *anyNode =
+      pointedByGraph.getNode(nodeFactory.getUniversalObjNode());
+  auto objItr = objNode->begin(), objIte = objNode->end();
+  auto anyItr = anyNode->begin(), anyIte = anyNode->end();
+  while (objItr != objIte || anyItr != anyIte) {
+    NodeIndex rep;
+    if (anyItr == anyIte || (objItr != objIte && *objItr < *anyItr))
+      rep = *objItr++;
+    else if (objItr == objIte || *anyItr < *objItr)
+      rep = *anyItr++;
+    else {
+      rep = *objItr++;
+      ++anyItr;
+    }
+
+    for (auto member : *repMemberGraph.getNode(rep))
+      ptrs.push_back(nodeFactory.getValueForNode(member));
   }
   return true;
 }
 
-bool Andersen::runOnModule(const Module &M) {
+bool Andersen::runOnModule(const Module &M, bool async) {
   collectConstraints(M);
 
   if (DumpDebugInfo)
     dumpConstraintsPlainVanilla();
 
-  optimizeConstraints();
+  // Follow the values from now on, so that nothing is missed while solving
+  std::vector<const Value *> vals;
+  nodeFactory.getMappedValues(vals);
+  for (auto val : vals)
+    trackValue(val);
+
+  if (async) {
+    pendingSolve = std::async(std::launch::async, [this]() { solve(); });
+    return false;
+  }
+  solve();
+  finishSolve();
+  return false;
+}
+
+void Andersen::solve() {
+  // The offline constraint graph is built on demand and shared by the offline
+  // optimizations and HCD
+  OfflineConstraintGraph offlineGraph(nodeFactory);
+  optimizeConstraints(offlineGraph);
 
   if (DumpConstraintInfo)
     dumpConstraints();
 
-  solveConstraints();
+  solveConstraints(offlineGraph);
+}
+
+void Andersen::finishSolve() {
+  // The points-to sets never change from now on. Move them into the store,
+  // and let go of what only the solver needed. The solver kept the sets over
+  // object ids, while the store keeps the object nodes themselves
+  AndersPtsSetStore::Builder storeBuilder;
+  unsigned emptySetId = storeBuilder.addSet(AndersPtsSet());
+  assert(emptySetId == EmptySetId);
+  (void)emptySetId;
+  repSetIds.reserve(ptsGraph.size());
+  for (auto const &mapping : ptsGraph)
+    repSetIds[mapping.first] =
+        storeBuilder.addSet(mapping.second, nodeFactory.getObjectNodes());
+  storeBuilder.finish(ptsSetStore);
+  ptsGraph.clear();
+  constraints.clear();
+  constraints.shrink_to_fit();
+
+  unsigned numSets = ptsSetStore.getNumSets();
+  ptsSetFacts.reserve(numSets);
+  for (unsigned id = 0; id < numSets; ++id)
+    ptsSetFacts.push_back(computePtsSetFacts(id));
 
   if (DumpDebugInfo) {
     errs() << "\n";
@@ -76,8 +298,22 @@ bool Andersen::runOnModule(const Module &M) {
     errs() << "\n";
     dumpPtsGraphPlainVanilla();
   }
+}
 
-  return false;
+void Andersen::waitForSolve() const {
+  if (!pendingSolve.valid())
+    return;
+
+  // This leaves pendingSolve invalid, so it happens once. What finishSolve()
+  // computes is part of the result, as if the constructor had done it
+  pendingSolve.get();
+  const_cast<Andersen *>(this)->finishSolve();
+}
+
+bool Andersen::isSolved() const {
+  return !pendingSolve.valid() ||
+         pendingSolve.wait_for(std::chrono::seconds(0)) ==
+             std::future_status::ready;
 }
 
 void Andersen::dumpConstraint(const AndersConstraint &item) const {
@@ -131,12 +367,74 @@ void Andersen::dumpConstraintsPlainVanilla() const {
 void Andersen::dumpPtsGraphPlainVanilla() const {
   for (unsigned i = 0, e = nodeFactory.getNumNodes(); i < e; ++i) {
     NodeIndex rep = nodeFactory.getMergeTarget(i);
-    auto ptsItr = ptsGraph.find(rep);
-    if (ptsItr != ptsGraph.end()) {
+    if (const AndersPtsSetFacts *facts = getPtsSetFacts(rep)) {
       errs() << i << " ";
-      for (auto v : ptsItr->second)
+      for (auto v : facts->elements)
         errs() << v << " ";
       errs() << "\n";
     }
   }
 }
+
+void AndersValueHandle::deleted() {
+  // This destroys the handle
+  anders->removeValue(getValPtr());
+}
+
+void AndersValueHandle::allUsesReplacedWith(Value *newVal) {
+  // This destroys the handle
+  anders->replaceValue(getValPtr(), newVal);
+}
+
+void Andersen::trackValue(const Value *val) {
+  if (valueHandleMap.count(val))
+    return;
+  valueHandles.emplace_back(const_cast<Value *>(val), this);
+  valueHandleMap[val] = std::prev(valueHandles.end());
+}
+
+void Andersen::untrackValue(const Value *val) {
+  auto itr = valueHandleMap.find(val);
+  if (itr == valueHandleMap.end())
+    return;
+  valueHandles.erase(itr->second);
+  valueHandleMap.erase(itr);
+}
+
+void Andersen::replaceValue(const Value *oldVal, const Value *newVal) {
+  nodeFactory.replaceValue(oldVal, newVal);
+  if (nodeFactory.hasNodesFor(newVal))
+    trackValue(newVal);
+  ++valueEpoch;
+  pointedByBuilt = false;
+  frozen = false;
+  // oldVal may be the value of the calling handle, so this goes last
+  untrackValue(oldVal);
+}
+
+void Andersen::removeValue(const Value *val) {
+  nodeFactory.removeValue(val);
+  ++valueEpoch;
+  pointedByBuilt = false;
+  frozen = false;
+  // val may be the value of the calling handle, so this goes last
+  untrackValue(val);
+}
+
+void Andersen::copyValue(const Value *from, const Value *to) {
+  // Unlike the others, this merges nodes
+  waitForSolve();
+  nodeFactory.copyValue(from, to);
+  if (nodeFactory.hasNodesFor(to))
+    trackValue(to);
+  ++valueEpoch;
+  pointedByBuilt = false;
+  frozen = false;
+}
+
+void Andersen::copyValues(const ValueToValueMapTy &vmap) {
+  for (auto const &mapping : vmap) {
+    if (const Value *to = mapping.second)
+      copyValue(mapping.first, to);
+  }
+}
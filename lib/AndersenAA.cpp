@@ -1,46 +1,125 @@
 #include "AndersenAA.h"
 
+#include "llvm/Config/llvm-config.h"
 #include "llvm/IR/Module.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Support/CommandLine.h"
+#if LLVM_VERSION_MAJOR >= 7
+#include "llvm/Passes/PassPlugin.h"
+#endif
+
+#include <algorithm>
 
 using namespace llvm;
 
-static inline bool isSetContainingOnly(const AndersPtsSet &set, NodeIndex i) {
-  return (set.getSize() == 1) && (*set.begin() == i);
+cl::opt<bool> AsyncSolve(
+    "anders-async",
+    cl::desc("Solve in the background, and only block the first alias query"),
+    cl::init(false));
+
+AndersenAAResult::PointerInfo
+AndersenAAResult::lookupPointerInfo(const Value *v) const {
+  anders->waitForSolve();
+  const AndersNodeFactory &nodeFactory = anders->nodeFactory;
+  PointerInfo info;
+  info.rep = nodeFactory.getValueNodeFor(v);
+  info.facts = nullptr;
+  info.hasCopies = false;
+  if (info.rep != AndersNodeFactory::InvalidIndex) {
+    info.rep = nodeFactory.getMergeTarget(info.rep);
+    info.hasCopies = nodeFactory.hasValueCopies(info.rep);
+    info.facts = anders->getPtsSetFacts(info.rep);
+    // A pointer that may point to anything is as good as one we know nothing
+    // about, so it may-alias everything without a look at its set
+    if (info.facts && info.facts->hasUniversalObj)
+      info.facts = nullptr;
+  }
+  return info;
+}
+
+AndersenAAResult::PointerInfo
+AndersenAAResult::getPointerInfo(const Value *v) {
+  if (frozen)
+    return lookupPointerInfo(v);
+
+  // A replaced or deleted value may leave a stale entry behind, and a new
+  // value may take over its address. A copied value turns must-aliases into
+  // may-aliases
+  if (ptrCacheEpoch != anders->getValueEpoch()) {
+    ptrCache.clear();
+    aliasCache.clear();
+    ptrCacheEpoch = anders->getValueEpoch();
+  }
+  auto itr = ptrCache.find(v);
+  if (itr != ptrCache.end())
+    return itr->second;
+
+  PointerInfo info = lookupPointerInfo(v);
+  ptrCache.insert(std::make_pair(v, info));
+  return info;
 }
 
 AliasResult AndersenAAResult::andersenAlias(const Value *v1, const Value *v2) {
-  NodeIndex n1 = (anders.nodeFactory)
-                     .getMergeTarget((anders.nodeFactory).getValueNodeFor(v1));
-  NodeIndex n2 = (anders.nodeFactory)
-                     .getMergeTarget((anders.nodeFactory).getValueNodeFor(v2));
+  PointerInfo p1 = getPointerInfo(v1);
+  PointerInfo p2 = getPointerInfo(v2);
+  if (p1.rep == AndersNodeFactory::InvalidIndex ||
+      p2.rep == AndersNodeFactory::InvalidIndex)
+    // At least one of (v1, v2) is not a pointer the analysis knows about
+    return MayAlias;
 
-  if (n1 == n2)
-    return MustAlias;
+  if (p1.rep == p2.rep)
+    // Clones of a value share its representative, but they are different
+    // values at run time
+    return p1.hasCopies ? MayAlias : MustAlias;
 
-  auto itr1 = (anders.ptsGraph).find(n1), itr2 = (anders.ptsGraph).find(n2);
-  if (itr1 == (anders.ptsGraph).end() || itr2 == (anders.ptsGraph).end())
+  if (!p1.facts || !p2.facts)
     // We knows nothing about at least one of (v1, v2)
     return MayAlias;
 
-  AndersPtsSet &s1 = itr1->second, s2 = itr2->second;
-  bool isNull1 =
-      isSetContainingOnly(s1, (anders.nodeFactory).getNullObjectNode());
-  bool isNull2 =
-      isSetContainingOnly(s2, (anders.nodeFactory).getNullObjectNode());
-  if (isNull1 || isNull2)
+  // Most queries end in NoAlias, and most of those are answered here without
+  // touching the sets or the cache
+  if ((p1.facts->signature & p2.facts->signature) == 0)
+    return NoAlias;
+
+  if (frozen)
+    return computeAlias(*p1.facts, *p2.facts);
+
+  // Alias is symmetric, so both orders of a pair share a cache entry
+  std::pair<NodeIndex, NodeIndex> key = std::minmax(p1.rep, p2.rep);
+  auto itr = aliasCache.find(key);
+  if (itr != aliasCache.end())
+    return itr->second;
+
+  AliasResult res = computeAlias(*p1.facts, *p2.facts);
+  aliasCache.insert(std::make_pair(key, res));
+  return res;
+}
+
+AliasResult AndersenAAResult::computeAlias(const AndersPtsSetFacts &f1,
+                                           const AndersPtsSetFacts &f2) const {
+  // Sets whose signatures don't overlap share no element other than the null
+  // object. This covers the null-only sets as well
+  if ((f1.signature & f2.signature) == 0)
+    return NoAlias;
+
+  if (f1.isNullOnly || f2.isNullOnly)
     // If any of them is null, we know that they must not alias each other
     return NoAlias;
 
-  if (s1.getSize() == 1 && s2.getSize() == 1 && *s1.begin() == *s2.begin())
+  // A single element that stands for several location equivalent objects, or
+  // for the clones of an allocation, doesn't give us a must-alias
+  const AndersNodeFactory &nodeFactory = anders->nodeFactory;
+  if (f1.singleElement != AndersNodeFactory::InvalidIndex &&
+      f1.singleElement == f2.singleElement &&
+      nodeFactory.getLocationEquivalents(f1.singleElement).empty() &&
+      !nodeFactory.hasObjectCopies(f1.singleElement))
     return MustAlias;
 
-  // Compute the intersection of s1 and s2
-  for (auto const &idx : s1) {
-    if (idx == (anders.nodeFactory).getNullObjectNode())
-      continue;
-    if (s2.has(idx))
-      return MayAlias;
-  }
+  // Two pointers that may both be null don't alias through the null object
+  NodeIndex nullObj = nodeFactory.getNullObjectNode();
+  if (AndersPtsSetStore::intersectWithExcept(f1.elements, f2.elements,
+                                             nullObj))
+    return MayAlias;
 
   return NoAlias;
 }
@@ -62,40 +141,225 @@ AliasResult AndersenAAResult::alias(const MemoryLocation &l1,
   return andersenAlias(v1, v2);
 }
 
+unsigned
+AndersenAAResult::getAliasClasses(ArrayRef<const Value *> ptrs,
+                                  std::vector<unsigned> &classes,
+                                  std::vector<AliasResult> *matrix) {
+  const unsigned numPtrs = ptrs.size();
+  const unsigned NoSet = ~0u;
+  NodeIndex nullObj = (anders->nodeFactory).getNullObjectNode();
+
+  // Resolve every pointer to its representative, and every representative to
+  // a local id of its points-to set. The stored sets are deduplicated, so
+  // representatives with equal points-to sets get the same id, and each
+  // distinct set is only looked at once below. Pointers the analysis knows
+  // nothing about get NoSet
+  std::vector<const Value *> vals(numPtrs);
+  auto isPointer = [&vals](unsigned i) {
+    return vals[i]->getType()->isPointerTy();
+  };
+  std::vector<NodeIndex> reps(numPtrs, AndersNodeFactory::InvalidIndex);
+  std::vector<unsigned> setIds(numPtrs, NoSet);
+  std::vector<const AndersPtsSetFacts *> sets;
+  DenseMap<NodeIndex, unsigned> repSetIds;
+  DenseMap<unsigned, unsigned> storeSetIds;
+  for (unsigned i = 0; i < numPtrs; ++i) {
+    vals[i] = ptrs[i]->stripPointerCasts();
+    if (!isPointer(i))
+      continue;
+    PointerInfo info = getPointerInfo(vals[i]);
+    NodeIndex rep = reps[i] = info.rep;
+    if (rep == AndersNodeFactory::InvalidIndex)
+      continue;
+
+    auto repItr = repSetIds.find(rep);
+    if (repItr != repSetIds.end()) {
+      setIds[i] = repItr->second;
+      continue;
+    }
+    if (const AndersPtsSetFacts *facts = info.facts) {
+      auto setItr =
+          storeSetIds.insert(std::make_pair(facts->setId, sets.size())).first;
+      if (setItr->second == sets.size())
+        sets.push_back(facts);
+      setIds[i] = setItr->second;
+    }
+    repSetIds[rep] = setIds[i];
+  }
+
+  // Union-find over the pointers
+  std::vector<unsigned> parent(numPtrs);
+  for (unsigned i = 0; i < numPtrs; ++i)
+    parent[i] = i;
+  auto find = [&parent](unsigned i) {
+    while (parent[i] != i)
+      i = parent[i] = parent[parent[i]];
+    return i;
+  };
+  auto unite = [&](unsigned i, unsigned j) { parent[find(i)] = find(j); };
+
+  // Pointers with the same value or the same representative must-alias, and
+  // pointers the analysis knows nothing about may-alias every other pointer.
+  // Otherwise two pointers may-alias iff their points-to sets share an element
+  // other than the null object, so walk the elements of each distinct set once
+  DenseMap<const Value *, unsigned> valOwner;
+  DenseMap<NodeIndex, unsigned> repOwner, setOwner, objOwner;
+  int unknownOwner = -1;
+  for (unsigned i = 0; i < numPtrs; ++i) {
+    if (!isPointer(i))
+      continue;
+    auto valItr = valOwner.insert(std::make_pair(vals[i], i)).first;
+    unite(i, valItr->second);
+    if (reps[i] != AndersNodeFactory::InvalidIndex) {
+      auto repItr = repOwner.insert(std::make_pair(reps[i], i)).first;
+      unite(i, repItr->second);
+    }
+    if (setIds[i] == NoSet) {
+      if (unknownOwner < 0)
+        unknownOwner = i;
+      continue;
+    }
+
+    auto setItr = setOwner.find(setIds[i]);
+    if (setItr != setOwner.end()) {
+      // A set that has no element other than the null object doesn't
+      // may-alias anything, not even itself
+      if (!sets[setIds[i]]->isNullOnly && sets[setIds[i]]->size != 0)
+        unite(i, setItr->second);
+      continue;
+    }
+    setOwner[setIds[i]] = i;
+    for (auto obj : sets[setIds[i]]->elements) {
+      if (obj == nullObj)
+        continue;
+      auto objItr = objOwner.insert(std::make_pair(obj, i)).first;
+      unite(i, objItr->second);
+    }
+  }
+  if (unknownOwner >= 0) {
+    for (unsigned i = 0; i < numPtrs; ++i)
+      if (isPointer(i))
+        unite(i, unknownOwner);
+  }
+
+  // Number the classes in the order they first appear
+  DenseMap<unsigned, unsigned> classIds;
+  classes.resize(numPtrs);
+  for (unsigned i = 0; i < numPtrs; ++i) {
+    auto itr = classIds.insert(std::make_pair(find(i), classIds.size())).first;
+    classes[i] = itr->second;
+  }
+
+  if (matrix) {
+    // Pointers with different representatives alias each other the way their
+    // points-to sets do, so only the distinct sets need to be compared
+    const unsigned numSets = sets.size();
+    std::vector<AliasResult> setMatrix(numSets * numSets, NoAlias);
+    for (unsigned i = 0; i < numSets; ++i)
+      for (unsigned j = i; j < numSets; ++j)
+        setMatrix[i * numSets + j] = setMatrix[j * numSets + i] =
+            computeAlias(*sets[i], *sets[j]);
+
+    matrix->assign(numPtrs * numPtrs, NoAlias);
+    for (unsigned i = 0; i < numPtrs; ++i) {
+      if (!isPointer(i))
+        continue;
+      for (unsigned j = 0; j < numPtrs; ++j) {
+        if (!isPointer(j))
+          continue;
+        AliasResult &res = (*matrix)[i * numPtrs + j];
+        if (vals[i] == vals[j])
+          res = MustAlias;
+        else if (reps[i] == AndersNodeFactory::InvalidIndex ||
+                 reps[j] == AndersNodeFactory::InvalidIndex)
+          res = MayAlias;
+        else if (reps[i] == reps[j])
+          res = (anders->nodeFactory).hasValueCopies(reps[i]) ? MayAlias
+                                                              : MustAlias;
+        else if (setIds[i] == NoSet || setIds[j] == NoSet)
+          res = MayAlias;
+        else
+          res = setMatrix[setIds[i] * numSets + setIds[j]];
+      }
+    }
+  }
+
+  return classIds.size();
+}
+
 bool AndersenAAResult::pointsToConstantMemory(const MemoryLocation &loc,
                                               bool orLocal) {
-  NodeIndex node = (anders.nodeFactory).getValueNodeFor(loc.Ptr);
-  if (node == AndersNodeFactory::InvalidIndex)
-    return false;
-
-  auto itr = (anders.ptsGraph).find(node);
-  if (itr == (anders.ptsGraph).end())
+  const AndersPtsSetFacts *facts = getPointerInfo(loc.Ptr).facts;
+  if (facts == nullptr)
     // Not a pointer?
     return false;
 
-  const AndersPtsSet &ptsSet = itr->second;
-  for (auto const &idx : ptsSet) {
-    if (const Value *val = (anders.nodeFactory).getValueForNode(idx)) {
-      if (!isa<GlobalValue>(val) || (isa<GlobalVariable>(val) &&
-                                     !cast<GlobalVariable>(val)->isConstant()))
-        return false;
-    } else {
-      if (idx != (anders.nodeFactory).getNullObjectNode())
-        return false;
-    }
-  }
+  return facts->isConstantMemory;
+}
+
+void AndersenAAResult::freeze() {
+  // The analysis has to be frozen again after IR maintenance, even if we are
+  // frozen already
+  anders->freeze();
+  ptrCache.shrink_and_clear();
+  aliasCache.shrink_and_clear();
+  frozen = true;
+}
 
-  return true;
+bool AndersenAAResult::invalidate(Module &, const PreservedAnalyses &pa,
+                                  ModuleAnalysisManager::Invalidator &) {
+  return !pa.getChecker<AndersenAA>().preservedWhenStateless();
 }
 
-AndersenAAResult::AndersenAAResult(const Module &m) : anders(m) {}
+AndersenAAResult::AndersenAAResult(const Module &m, bool async)
+    : anders(new Andersen(m, async)), frozen(false), ptrCacheEpoch(0) {}
+
+AnalysisKey AndersenAA::Key;
+
+AndersenAAResult AndersenAA::run(Module &m, ModuleAnalysisManager &) {
+  return AndersenAAResult(m, AsyncSolve);
+}
+
+void registerAndersenAA(PassBuilder &pb) {
+  pb.registerAnalysisRegistrationCallback([](ModuleAnalysisManager &mam) {
+    mam.registerPass([] { return AndersenAA(); });
+  });
+  pb.registerPipelineParsingCallback(
+      [](StringRef name, ModulePassManager &mpm,
+         ArrayRef<PassBuilder::PipelineElement>) {
+        if (name == "require<anders-aa>") {
+          mpm.addPass(RequireAnalysisPass<AndersenAA, Module>());
+          return true;
+        }
+        if (name == "invalidate<anders-aa>") {
+          mpm.addPass(InvalidateAnalysisPass<AndersenAA>());
+          return true;
+        }
+        return false;
+      });
+#if LLVM_VERSION_MAJOR >= 7
+  pb.registerParseAACallback([](StringRef name, AAManager &aa) {
+    if (name != "anders-aa")
+      return false;
+    aa.registerModuleAnalysis<AndersenAA>();
+    return true;
+  });
+#endif
+}
+
+#if LLVM_VERSION_MAJOR >= 7
+// Entry point for loading the shared library with -load-pass-plugin
+extern "C" LLVM_ATTRIBUTE_WEAK PassPluginLibraryInfo llvmGetPassPluginInfo() {
+  return {LLVM_PLUGIN_API_VERSION, "AndersenAA", "v0.1", registerAndersenAA};
+}
+#endif
 
 void AndersenAAWrapperPass::getAnalysisUsage(AnalysisUsage &AU) const {
   AU.setPreservesAll();
 }
 
 bool AndersenAAWrapperPass::runOnModule(Module &m) {
-  result.reset(new AndersenAAResult(m));
+  result.reset(new AndersenAAResult(m, AsyncSolve));
 
   return false;
 }
@@ -16,6 +16,18 @@ using namespace llvm;
 // constraint, and setting up the initial points-to graph.
 
 void Andersen::collectConstraints(const Module &M) {
+  // Every global, function, argument and instruction gets at most a value
+  // node and an object node, and functions get their return and vararg nodes
+  // on top. Most get a single node, so this is roughly how large the node
+  // table will grow
+  unsigned numValues = M.global_size();
+  for (auto const &f : M) {
+    numValues += 2 + f.arg_size();
+    for (auto const &bb : f)
+      numValues += bb.size();
+  }
+  nodeFactory.reserve(numValues + numValues / 2);
+
   // First, the universal ptr points to universal obj, and the universal obj
   // points to itself
   constraints.emplace_back(AndersConstraint::ADDR_OF,
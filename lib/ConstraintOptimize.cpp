@@ -1,16 +1,20 @@
 #include "Andersen.h"
 #include "CycleDetector.h"
-#include "SparseBitVectorGraph.h"
+#include "HashedSparseBitVector.h"
+#include "OfflineConstraintGraph.h"
+#include "Unification.h"
 
+#include "llvm/ADT/BitVector.h"
 #include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/SparseBitVector.h"
 #include "llvm/Support/CommandLine.h"
-#include "llvm/Support/FileSystem.h"
-#include "llvm/Support/ToolOutputFile.h"
 #include "llvm/Support/raw_ostream.h"
 
+#include <algorithm>
 #include <deque>
+#include <map>
 #include <set>
 #include <unordered_map>
 
@@ -20,174 +24,73 @@ cl::opt<bool> EnableHVN("enable-hvn",
                         cl::desc("Enable the HVN constraint optimization"));
 cl::opt<bool> EnableHU("enable-hu",
                        cl::desc("Enable the HU constraint optimization"));
+cl::opt<bool>
+    EnableHR("enable-hr",
+             cl::desc("Enable the HR constraint optimization (HVN iterated "
+                      "until it stops making progress)"));
+cl::opt<bool>
+    EnableHRU("enable-hru",
+              cl::desc("Enable the HRU constraint optimization (HU iterated "
+                       "until it stops making progress)"));
+cl::opt<bool> EnableLE(
+    "enable-le",
+    cl::desc("Enable the location equivalence constraint optimization"));
+cl::opt<bool> EnableUnify(
+    "enable-unify",
+    cl::desc("Enable the unification constraint optimization (a Steensgaard "
+             "pre-analysis that drops the constraints it proves useless)"));
 
 namespace {
 
-struct SparseBitVectorHash {
-  std::size_t operator()(const SparseBitVector<> &vec) const {
-    std::size_t ret = 0;
-    for (auto const &idx : vec)
-      ret ^= idx;
-    return ret;
-  }
-};
-
-struct SparseBitVectorKeyEqual {
-  bool operator()(const SparseBitVector<> &lhs,
-                  const SparseBitVector<> &rhs) const {
-    return lhs == rhs;
-  }
-};
-
 // There is something in common in HVN and HU. Put all the shared stuffs in the
 // base class here
-class ConstraintOptimizer : public CycleDetector<SparseBitVectorGraph> {
+class ConstraintOptimizer : public CycleDetector<OfflineGraphView<true>> {
 protected:
   std::vector<AndersConstraint> &constraints;
   AndersNodeFactory &nodeFactory;
 
-  // The predecessor graph
-  SparseBitVectorGraph predGraph;
+  // The predecessor graph, shared with the other offline passes
+  OfflineConstraintGraph &offlineGraph;
   // Nodes that must be treated conservatively (i.e. never merge with others)
   // Note that REF nodes and ADR nodes are all automatically indirect nodes.
-  // This set only keep track of indirect nodes that are not REF or ADR
-  DenseSet<NodeIndex> indirectNodes;
+  // This bitmap only keep track of indirect nodes that are not REF or ADR, so
+  // it is indexed by VAR nodes only
+  BitVector indirectNodes;
 
-  // Map from NodeIndex to Pointer Equivalence Class
-  DenseMap<NodeIndex, unsigned> peLabel;
+  // Map from NodeIndex to Pointer Equivalence Class. It covers all the VAR, REF
+  // and ADR nodes, and nodes that are never labeled have label 0
+  std::vector<unsigned> peLabel;
   // Current pointer equivalence class number
   unsigned pointerEqClass;
+  // Whether the last run() merged any node or removed any constraint
+  bool changed;
 
   // Store the "representative" (or "leader") when there is a merge in the
-  // cycle. Note that this is different from AndersNode::mergeTarget, which will
-  // be set AFTER the optimization
-  DenseMap<NodeIndex, NodeIndex> mergeTarget;
-
-  // During variable substitution, we create unknowns to represent the unknown
-  // value that is a dereference of a variable.  These nodes are known as "ref"
-  // nodes (since they represent the value of dereferences) Return the node
-  // index of the "ref node" (used to represent *n) of n. We won't actually
-  // create that ref node. We cannot use the NodeIndex of that refNode to index
-  // into nodeFactory
-  NodeIndex getRefNodeIndex(NodeIndex n) const {
-    assert(n < nodeFactory.getNumNodes());
-    return n + nodeFactory.getNumNodes();
-  }
-
-  // Return the node index of the "adr node" (used to represent &n) of n. Only
-  // addr-taken vars can be adr-ed We won't actually create that adr node. We
-  // cannot use the NodeIndex of that adrNode to index into nodeFactory
-  NodeIndex getAdrNodeIndex(NodeIndex n) const {
-    assert(n < nodeFactory.getNumNodes());
-    return n + 2 * nodeFactory.getNumNodes();
-  }
-
-  void buildPredecessorGraph() {
-    for (auto const &c : constraints) {
-      NodeIndex srcTgt = nodeFactory.getMergeTarget(c.getSrc());
-      NodeIndex dstTgt = nodeFactory.getMergeTarget(c.getDest());
-      switch (c.getType()) {
-      case AndersConstraint::ADDR_OF: {
-        indirectNodes.insert(srcTgt);
-        // Dest = &src edge
-        predGraph.insertEdge(dstTgt, getAdrNodeIndex(srcTgt));
-        // *Dest = src edge
-        predGraph.insertEdge(getRefNodeIndex(dstTgt), srcTgt);
-        break;
-      }
-      case AndersConstraint::LOAD: {
-        // dest = *src edge
-        predGraph.insertEdge(dstTgt, getRefNodeIndex(srcTgt));
-        break;
-      }
-      case AndersConstraint::STORE: {
-        // *dest = src edge
-        predGraph.insertEdge(getRefNodeIndex(dstTgt), srcTgt);
-        break;
-      }
-      case AndersConstraint::COPY: {
-        // Dest = Src edge
-        predGraph.insertEdge(dstTgt, srcTgt);
-        // *Dest = *Src edge
-        predGraph.insertEdge(getRefNodeIndex(dstTgt), getRefNodeIndex(srcTgt));
-        break;
-      }
-      }
-    }
-  }
-
-  void printPredecessorGraphNode(raw_ostream &os, NodeIndex n) const {
-    if (n >= nodeFactory.getNumNodes() * 2)
-      os << "<ADR> ";
-    else if (n >= nodeFactory.getNumNodes())
-      os << "<REF> ";
-    os << "[Node " << n % nodeFactory.getNumNodes() << "]";
-  }
-
-  void dumpPredecessorGraph() const {
-    errs() << "\n----- Predecessor Graph -----\n";
-    for (auto const &mapping : predGraph) {
-      printPredecessorGraphNode(errs(), mapping.first);
-      errs() << "  -->  ";
-      const SparseBitVectorGraphNode &sNode = mapping.second;
-      for (auto const &idx : sNode) {
-        printPredecessorGraphNode(errs(), idx);
-        errs() << ", ";
-      }
-      errs() << '\n';
-    }
-    errs() << "----- End of Print -----\n";
+  // cycle. Note that this is different from the merge targets in the node
+  // factory, which will be set AFTER the optimization. Nodes that are not
+  // merged map to themselves
+  std::vector<NodeIndex> mergeTarget;
+  // Map from the representative of a cycle to the other nodes on the cycle.
+  // The cycles are not collapsed in offlineGraph since the other passes don't
+  // necessarily agree with them, so their predecessors are looked up here
+  DenseMap<NodeIndex, std::vector<NodeIndex>> cycleMembers;
+
+  bool isIndirectNode(NodeIndex n) const {
+    return n >= nodeFactory.getNumNodes() || indirectNodes.test(n);
   }
 
-  void writePredecessorGraphToFile() const {
-    std::error_code errInfo;
-    ToolOutputFile outFile("dots/pred.dot", errInfo, sys::fs::F_Text);
-    if (errInfo) {
-      errs() << errInfo.message() << '\n';
-      return;
-    }
-
-    raw_fd_ostream &os = outFile.os();
-    os << "digraph G {\n";
-    std::deque<bool> hasLabel(nodeFactory.getNumNodes() * 3, false);
-    for (auto const &mapping : predGraph) {
-      if (!hasLabel[mapping.first]) {
-        os << "\tnode" << mapping.first << " [label = \"";
-        printPredecessorGraphNode(os, mapping.first);
-        os << "\"]\n";
-        hasLabel[mapping.first] = true;
-      }
-      const SparseBitVectorGraphNode &sNode = mapping.second;
-      for (auto const &idx : sNode) {
-        if (!hasLabel[idx]) {
-          os << "\tnode" << idx << " [label = \"";
-          printPredecessorGraphNode(os, idx);
-          os << "\"]\n";
-          hasLabel[idx] = true;
-        }
-        os << "\tnode" << idx << " -> "
-           << "node" << mapping.first << '\n';
-      }
-    }
-    os << "}\n";
-
-    outFile.keep();
+  NodeIndex getMergeTargetRep(NodeIndex idx) const {
+    while (mergeTarget[idx] != idx)
+      idx = mergeTarget[idx];
+    return idx;
   }
 
-  NodeIndex getMergeTargetRep(NodeIndex idx) {
-    while (true) {
-      auto itr = mergeTarget.find(idx);
-      if (itr == mergeTarget.end())
-        break;
-      else
-        idx = itr->second;
-    }
-
-    return idx;
+  NodeIndex getRepIndex(NodeIndex idx) {
+    return getMergeTargetRep(offlineGraph.getMergeTarget(idx));
   }
 
   NodeType *getRep(NodeIndex idx) override {
-    return predGraph.getOrInsertNode(getMergeTargetRep(idx));
+    return offlineGraph.getNode(getRepIndex(idx));
   }
   // Specify how to process the non-rep nodes if a cycle is found
   void processNodeOnCycle(const NodeType *node,
@@ -195,11 +98,10 @@ protected:
     NodeIndex nodeIdx = node->getNodeIndex();
     NodeIndex repIdx = repNode->getNodeIndex();
     mergeTarget[nodeIdx] = getMergeTargetRep(repIdx);
-    if (repIdx < nodeFactory.getNumNodes() &&
-        (indirectNodes.count(nodeIdx) || nodeIdx > nodeFactory.getNumNodes()))
-      indirectNodes.insert(repIdx);
+    if (repIdx < nodeFactory.getNumNodes() && isIndirectNode(nodeIdx))
+      indirectNodes.set(repIdx);
 
-    predGraph.mergeEdge(repIdx, nodeIdx);
+    cycleMembers[repIdx].push_back(nodeIdx);
   }
 
   // Specify how to process the rep nodes if a cycle is found
@@ -207,7 +109,26 @@ protected:
     propagateLabel(node->getNodeIndex());
   }
 
-  void rewriteConstraint() {
+  // Collect the representatives of the predecessors of node into predReps. If
+  // node represents a cycle, the predecessors of the other nodes on the cycle
+  // are collected as well
+  void collectPredReps(NodeIndex node, SparseBitVector<> &predReps) {
+    auto collect = [&](NodeIndex n) {
+      const CSRGraphNode *gNode = offlineGraph.getNode(n);
+      for (auto pred : *gNode)
+        predReps.set(getRepIndex(pred));
+    };
+
+    collect(node);
+    auto itr = cycleMembers.find(node);
+    if (itr != cycleMembers.end()) {
+      for (auto member : itr->second)
+        collect(member);
+    }
+  }
+
+  // Return true if any node is merged or any constraint is removed
+  bool rewriteConstraint() {
     // Since only direct VAR nodes can be assigned non-unique labels, there are
     // only three cases to consider: VAR+VAR, VAR+REF, and VAR+ADR
     // - For VAR+VAR, just merge one node into the other
@@ -221,16 +142,12 @@ protected:
                                        AndersNodeFactory::InvalidIndex);
     // Scan all the VAR nodes to see if any of them have the same label as other
     // VAR nodes. We have to perform the merge before constraint rewriting
-
-    for (auto const &mapping : peLabel) {
-      NodeIndex node = mapping.first;
-      if (node >= nodeFactory.getNumNodes())
-        continue;
-
+    unsigned numMerged = 0;
+    for (NodeIndex node = 0, e = nodeFactory.getNumNodes(); node < e; ++node) {
       if (nodeFactory.getMergeTarget(node) != node)
         continue;
 
-      unsigned iLabel = mapping.second;
+      unsigned iLabel = peLabel[node];
       if (revLabelMap[iLabel] == AndersNodeFactory::InvalidIndex)
         revLabelMap[iLabel] = node;
       else if (iLabel != 0) // We have already found a VAR or ADR node with the
@@ -239,32 +156,52 @@ protected:
       {
         // errs() << "MERGE " << i << "with" << revLabelMap[iLabel] << "\n";
         nodeFactory.mergeNode(revLabelMap[iLabel], node);
+        ++numMerged;
       }
     }
 
-    // Collect all peLabels that are assigned to ADR nodes
-    for (auto const &mapping : peLabel) {
-      NodeIndex node = mapping.first;
-      if (node < nodeFactory.getNumNodes() * 2)
-        continue;
+    // Collect all peLabels that are assigned to ADR nodes. A load through a
+    // pointer to the universal object may load anything, which the solver
+    // only knows if the load is still there, so &universal is left out
+    NodeIndex univAdr =
+        offlineGraph.getAdrNodeIndex(nodeFactory.getUniversalObjNode());
+    for (NodeIndex node = nodeFactory.getNumNodes() * 2, e = peLabel.size();
+         node < e; ++node) {
+      if (peLabel[node] != 0 && node != univAdr)
+        revLabelMap[peLabel[node]] = node;
+    }
 
-      NodeIndex varNode = node - nodeFactory.getNumNodes() * 2;
-      if (nodeFactory.getMergeTarget(varNode) != varNode)
+    // A VAR node with label 0 points to nothing, and a VAR node with the same
+    // label as &obj points to obj and nothing else. The rewriting below
+    // simplifies the dereferences of these nodes, so let the predecessor graph
+    // know as well
+    for (NodeIndex node = 0, e = nodeFactory.getNumNodes(); node < e; ++node) {
+      if (nodeFactory.getMergeTarget(node) != node)
         continue;
-      revLabelMap[mapping.second] = node;
+      if (peLabel[node] == 0) {
+        offlineGraph.setNoPointee(node);
+        continue;
+      }
+      NodeIndex adrNode = revLabelMap[peLabel[node]];
+      if (offlineGraph.isAdrNode(adrNode))
+        offlineGraph.setUniquePointee(node,
+                                      adrNode - nodeFactory.getNumNodes() * 2);
     }
 
     // Now scan all constraints and see if we can simplify them
     std::vector<AndersConstraint> newConstraints;
     for (auto const &c : constraints) {
-      // First, if the lhs has label 0 (non-ptr), ignore this constraint
-      if (peLabel[c.getDest()] == 0)
-        continue;
-
       // Change the lhs to its mergeTarget
       NodeIndex destTgt = nodeFactory.getMergeTarget(c.getDest());
       // Change the rhs to its merge target
       NodeIndex srcTgt = nodeFactory.getMergeTarget(c.getSrc());
+
+      // If the lhs has label 0 (non-ptr), ignore this constraint. Note that
+      // the lhs may have been merged before this optimizer runs, in which case
+      // only its merge target is labeled
+      if (peLabel[destTgt] == 0)
+        continue;
+
       switch (c.getType()) {
       case AndersConstraint::ADDR_OF: {
         // We don't want to replace src with srcTgt because, after all, the
@@ -341,40 +278,62 @@ protected:
     // There may be repetitive constraints. Uniquify them
     std::set<AndersConstraint> constraintSet(newConstraints.begin(),
                                              newConstraints.end());
+    bool removed = constraintSet.size() < constraints.size();
     constraints.assign(constraintSet.begin(), constraintSet.end());
+
+    return numMerged > 0 || removed;
   }
 
   virtual void releaseMemory() {
     indirectNodes.clear();
     peLabel.clear();
+    peLabel.shrink_to_fit();
     mergeTarget.clear();
-    predGraph.releaseMemory();
+    mergeTarget.shrink_to_fit();
+    cycleMembers.clear();
     releaseSCCMemory();
   }
 
   virtual void propagateLabel(NodeIndex node) = 0;
 
 public:
-  ConstraintOptimizer(std::vector<AndersConstraint> &c, AndersNodeFactory &n)
-      : constraints(c), nodeFactory(n), pointerEqClass(1) {
-    // Build a predecessor graph.  This is like our constraint graph with the
-    // edges going in the opposite direction, and there are edges for all the
-    // constraints, instead of just copy constraints.  We also build implicit
-    // edges for constraints are implied but not explicit.  I.E for the
-    // constraint a = &b, we add implicit edges *a = b.  This helps us capture
-    // more cycles
-    buildPredecessorGraph();
+  ConstraintOptimizer(std::vector<AndersConstraint> &c, AndersNodeFactory &n,
+                      OfflineConstraintGraph &g)
+      : constraints(c), nodeFactory(n), offlineGraph(g),
+        peLabel(n.getNumNodes() * 3, 0), pointerEqClass(1), changed(false),
+        mergeTarget(n.getNumNodes() * 3) {
+    for (NodeIndex i = 0, e = mergeTarget.size(); i < e; ++i)
+      mergeTarget[i] = i;
+
+    // The predecessor graph is like our constraint graph with the edges going
+    // in the opposite direction, and there are edges for all the constraints,
+    // instead of just copy constraints. Bring it up to date with the nodes
+    // merged since it was built
+    offlineGraph.updateMerges();
+    indirectNodes = offlineGraph.getAddrTakenNodes();
   }
 
   void run() override {
-    // Now run Tarjan's SCC algorithm to find cycles, condense predGraph, and
-    // explore possible equivalence relations
+    // Now run Tarjan's SCC algorithm to find cycles, condense the predecessor
+    // graph, and explore possible equivalence relations
+    OfflineGraphView<true> predGraph(offlineGraph);
     runOnGraph(&predGraph);
 
+    // An indirect node that no edge touches is never visited, but it still
+    // holds whatever the solver stores into it (through a pointer to the
+    // universal object, for instance), so it gets a label of its own
+    for (NodeIndex i = 0, e = nodeFactory.getNumNodes(); i < e; ++i) {
+      if (peLabel[i] == 0 && nodeFactory.getMergeTarget(i) == i &&
+          isIndirectNode(i))
+        propagateLabel(i);
+    }
+
     // For all nodes on the same cycle: assign their representative's pe label
     // to them
-    for (auto const &mapping : mergeTarget)
-      peLabel[mapping.first] = peLabel[getMergeTargetRep(mapping.second)];
+    for (NodeIndex i = 0, e = mergeTarget.size(); i < e; ++i) {
+      if (mergeTarget[i] != i)
+        peLabel[i] = peLabel[getMergeTargetRep(i)];
+    }
 
     /*for (unsigned i = 0; i < peLabel.size(); ++i)
     {
@@ -383,8 +342,10 @@ public:
     }*/
 
     // We've done labelling. Now rewrite all constraints
-    rewriteConstraint();
+    changed = rewriteConstraint();
   }
+
+  bool hasChanged() const { return changed; }
 };
 
 // The technique used here is described in "Exploiting Pointer and Location
@@ -399,13 +360,12 @@ public:
 class HVNOptimizer : public ConstraintOptimizer {
 private:
   // Map from a set of NodeIndex to Pointer Equivalence Class
-  std::unordered_map<SparseBitVector<>, unsigned, SparseBitVectorHash,
-                     SparseBitVectorKeyEqual>
+  std::unordered_map<HashedSparseBitVector, unsigned, HashedSparseBitVectorHash>
       setLabel;
 
   void propagateLabel(NodeIndex node) override {
     // Indirect node always gets a unique label
-    if (node >= nodeFactory.getNumNodes() || indirectNodes.count(node)) {
+    if (isIndirectNode(node)) {
       peLabel[node] = pointerEqClass++;
       return;
     }
@@ -413,23 +373,21 @@ private:
     // Scan through the predecessor edges and examine what labels they have
     bool allSame = true;
     unsigned lastSeenLabel = 0;
-    SparseBitVector<> predLabels;
-    const SparseBitVectorGraphNode *sNode = predGraph.getNodeWithIndex(node);
-    if (sNode != nullptr) {
-      for (auto const &pred : *sNode) {
-        NodeIndex predRep = getMergeTargetRep(pred);
-        unsigned predRepLabel = peLabel[predRep];
-        // Ignore labels that are equal to us or non-pointers
-        if (predRep == node || predRepLabel == 0)
-          continue;
+    HashedSparseBitVector predLabels;
+    SparseBitVector<> predReps;
+    collectPredReps(node, predReps);
+    for (auto predRep : predReps) {
+      unsigned predRepLabel = peLabel[predRep];
+      // Ignore labels that are equal to us or non-pointers
+      if (predRep == node || predRepLabel == 0)
+        continue;
 
-        if (lastSeenLabel == 0)
-          lastSeenLabel = predRepLabel;
-        else if (allSame && predRepLabel != lastSeenLabel)
-          allSame = false;
+      if (lastSeenLabel == 0)
+        lastSeenLabel = predRepLabel;
+      else if (allSame && predRepLabel != lastSeenLabel)
+        allSame = false;
 
-        predLabels.set(predRepLabel);
-      }
+      predLabels.insert(predRepLabel);
     }
 
     // We either have a non-pointer, a copy of an existing node, or a new node.
@@ -451,8 +409,9 @@ private:
   }
 
 public:
-  HVNOptimizer(std::vector<AndersConstraint> &c, AndersNodeFactory &n)
-      : ConstraintOptimizer(c, n) {}
+  HVNOptimizer(std::vector<AndersConstraint> &c, AndersNodeFactory &n,
+               OfflineConstraintGraph &g)
+      : ConstraintOptimizer(c, n, g) {}
 
   void releaseMemory() override {
     ConstraintOptimizer::releaseMemory();
@@ -468,11 +427,28 @@ public:
 class HUOptimizer : public ConstraintOptimizer {
 private:
   // Map from a set of NodeIndex to Pointer Equivalence Class
-  std::unordered_map<SparseBitVector<>, unsigned, SparseBitVectorHash,
-                     SparseBitVectorKeyEqual>
+  std::unordered_map<HashedSparseBitVector, unsigned, HashedSparseBitVectorHash>
       setLabel;
-  // Map from NodeIndex to its offline pts-set
-  DenseMap<unsigned, SparseBitVector<>> ptsSet;
+  // The offline pts-sets. Nodes with the same label have the same pts-set, so
+  // we keep one copy per label: labelPtsSet[l] is the pts-set shared by all
+  // nodes labeled l, and label 0 stands for the empty set. A deque never moves
+  // its elements on push_back(), so references into it stay valid while new
+  // labels are created
+  std::deque<HashedSparseBitVector> labelPtsSet;
+
+  // Assign a brand new label to node, whose pts-set is set
+  void assignNewLabel(NodeIndex node, HashedSparseBitVector &&set) {
+    assert(labelPtsSet.size() == pointerEqClass);
+    labelPtsSet.push_back(std::move(set));
+    peLabel[node] = pointerEqClass++;
+  }
+
+  // Assign a brand new label to node, whose pts-set is {elem}
+  void assignUniqueLabel(NodeIndex node, NodeIndex elem) {
+    HashedSparseBitVector set;
+    set.insert(elem);
+    assignNewLabel(node, std::move(set));
+  }
 
   // Try to assign a single label to node. Return true if the assignment
   // succeeds
@@ -480,24 +456,21 @@ private:
     // ADR nodes get a unique label and a pts-set that contains the
     // corresponding VAR node
     if (node >= nodeFactory.getNumNodes() * 2) {
-      peLabel[node] = pointerEqClass++;
-      ptsSet[node].set(node - nodeFactory.getNumNodes() * 2);
+      assignUniqueLabel(node, node - nodeFactory.getNumNodes() * 2);
       return true;
     }
 
     // REF nodes get a unique label and a pts-set that contains itself (which
     // can never collide with VAR nodes)
     if (node >= nodeFactory.getNumNodes()) {
-      peLabel[node] = pointerEqClass++;
-      ptsSet[node].set(node);
+      assignUniqueLabel(node, node);
       return true;
     }
 
     // Indirect VAR nodes get a unique label and a pts-set that contains its
     // corresponding ADR node (which can never collide with VAR and REF nodes)
-    if (indirectNodes.count(node)) {
-      peLabel[node] = pointerEqClass++;
-      ptsSet[node].set(getAdrNodeIndex(node));
+    if (isIndirectNode(node)) {
+      assignUniqueLabel(node, offlineGraph.getAdrNodeIndex(node));
       return true;
     }
 
@@ -509,16 +482,13 @@ private:
       return;
 
     // Direct VAR nodes need more careful examination
-    SparseBitVector<> &myPtsSet = ptsSet[node];
-    SparseBitVectorGraphNode *sNode = predGraph.getNodeWithIndex(node);
-    if (sNode != nullptr) {
-      for (auto const &pred : *sNode) {
-        // Be careful! Any insertion to ptsSet here will invalidate myPtsSet
-        NodeIndex predRep = getMergeTargetRep(pred);
-        auto itr = ptsSet.find(predRep);
-        if (itr != ptsSet.end())
-          myPtsSet |= (itr->second);
-      }
+    HashedSparseBitVector myPtsSet;
+    SparseBitVector<> predReps;
+    collectPredReps(node, predReps);
+    for (auto predRep : predReps) {
+      unsigned predLabel = peLabel[predRep];
+      if (predLabel != 0)
+        myPtsSet.unionWith(labelPtsSet[predLabel]);
     }
 
     // errs() << "ptsSet [" << node << "] = ";
@@ -536,53 +506,289 @@ private:
         peLabel[node] = labelItr->second;
       } else {
         setLabel.insert(std::make_pair(myPtsSet, pointerEqClass));
-        peLabel[node] = pointerEqClass;
-        ++pointerEqClass;
+        assignNewLabel(node, std::move(myPtsSet));
       }
     }
   }
 
 public:
-  HUOptimizer(std::vector<AndersConstraint> &c, AndersNodeFactory &n)
-      : ConstraintOptimizer(c, n) {}
+  HUOptimizer(std::vector<AndersConstraint> &c, AndersNodeFactory &n,
+              OfflineConstraintGraph &g)
+      : ConstraintOptimizer(c, n, g) {
+    // The pts-set of label 0
+    labelPtsSet.emplace_back();
+  }
 
   void releaseMemory() override {
     ConstraintOptimizer::releaseMemory();
-    ptsSet.clear();
+    labelPtsSet.clear();
     setLabel.clear();
   }
 };
 
+// The technique used here is described in "Exploiting Pointer and Location
+// Equivalence to Optimize Pointer Analysis. In the 14th International Static
+// Analysis Symposium (SAS), August 2007." It is known as location equivalence
+// (LE). Two objects are location equivalent if every pointer that points to
+// one of them also points to the other. Since all points-to info originates
+// from addr_of constraints and flows along inclusion edges, this holds
+// whenever the two objects have their addresses taken by the same set of
+// pointer equivalence classes. Running HVN/HU first merges pointer equivalent
+// nodes, which makes the merge targets of the pointers a good approximation of
+// those classes.
+// Each class of location equivalent objects is represented by one object in
+// all points-to sets. The contents of the objects are merged as well: they can
+// only be accessed through pointers that point to all of them anyway.
+class LEOptimizer {
+private:
+  std::vector<AndersConstraint> &constraints;
+  AndersNodeFactory &nodeFactory;
+
+  // Map from an object to the set of pointers that take its address. We use
+  // std::map to make the choice of representatives deterministic
+  std::map<NodeIndex, HashedSparseBitVector> addrTakenBy;
+  // Map from an object to the representative of its location equivalence
+  // class. Representatives themselves are not in the map
+  DenseMap<NodeIndex, NodeIndex> locRep;
+
+  void buildAddrTakenMap() {
+    for (auto const &c : constraints) {
+      if (c.getType() != AndersConstraint::ADDR_OF)
+        continue;
+
+      // The special objects have their own meanings and never get merged
+      NodeIndex obj = c.getSrc();
+      if (obj == nodeFactory.getUniversalObjNode() ||
+          obj == nodeFactory.getNullObjectNode())
+        continue;
+
+      addrTakenBy[obj].insert(nodeFactory.getMergeTarget(c.getDest()));
+    }
+  }
+
+public:
+  LEOptimizer(std::vector<AndersConstraint> &c, AndersNodeFactory &n)
+      : constraints(c), nodeFactory(n) {
+    buildAddrTakenMap();
+  }
+
+  void run() {
+    // Objects with the same set of pointers are location equivalent
+    std::unordered_map<HashedSparseBitVector, NodeIndex,
+                       HashedSparseBitVectorHash>
+        setRep;
+    for (auto const &mapping : addrTakenBy) {
+      auto itr = setRep.insert(std::make_pair(mapping.second, mapping.first));
+      if (!itr.second)
+        locRep[mapping.first] = itr.first->second;
+    }
+    if (locRep.empty())
+      return;
+
+    for (auto const &mapping : locRep) {
+      NodeIndex obj = mapping.first, rep = mapping.second;
+      nodeFactory.mergeLocation(rep, obj);
+
+      NodeIndex objTgt = nodeFactory.getMergeTarget(obj);
+      NodeIndex repTgt = nodeFactory.getMergeTarget(rep);
+      if (objTgt != repTgt)
+        nodeFactory.mergeNode(repTgt, objTgt);
+    }
+
+    // Let the representatives stand for the entire class in addr_of
+    // constraints
+    std::vector<AndersConstraint> newConstraints;
+    newConstraints.reserve(constraints.size());
+    for (auto const &c : constraints) {
+      if (c.getType() == AndersConstraint::ADDR_OF) {
+        auto itr = locRep.find(c.getSrc());
+        if (itr != locRep.end()) {
+          newConstraints.emplace_back(AndersConstraint::ADDR_OF, c.getDest(),
+                                      itr->second);
+          continue;
+        }
+      }
+      newConstraints.push_back(c);
+    }
+
+    // There may be repetitive constraints. Uniquify them
+    std::set<AndersConstraint> constraintSet(newConstraints.begin(),
+                                             newConstraints.end());
+    constraints.assign(constraintSet.begin(), constraintSet.end());
+  }
+};
+
+// A unification based analysis (see AndersUnifier) finds a superset of the
+// points-to set of every node in almost linear time. What it proves to be
+// empty is empty for the inclusion solver as well, so the constraints that
+// copy, load or store an empty set, or load or store through a pointer to
+// nothing, can't do anything. Neither can anything flow into a pointer whose
+// own addr_of constraints already give it every object the superset has.
+// Such pointers have exactly that set, and the ones with the same set are
+// merged. What is left for the inclusion solver are the nodes whose sets the
+// pre-analysis can't tell, and with fewer constraints connecting them, they
+// fall apart into more parts for -partition-solve too
+class UnificationOptimizer {
+private:
+  std::vector<AndersConstraint> &constraints;
+  AndersNodeFactory &nodeFactory;
+  AndersUnifier unifier;
+
+  bool isEmpty(NodeIndex n) const {
+    return unifier.getPointeeClass(n) == AndersNodeFactory::InvalidIndex;
+  }
+  // Return true if what n points to points to nothing
+  bool isContentEmpty(NodeIndex n) const {
+    ArrayRef<NodeIndex> pointees = unifier.getPointees(n);
+    // The objects in a class all have the same contents
+    return pointees.empty() || isEmpty(pointees.front());
+  }
+
+  // Merge the pointers whose addr_of constraints take the address of every
+  // object they may point to, and return them
+  DenseSet<NodeIndex> mergePinnedPointers() {
+    std::map<NodeIndex, SmallVector<NodeIndex, 4>> addrTaken;
+    for (auto const &c : constraints)
+      if (c.getType() == AndersConstraint::ADDR_OF)
+        addrTaken[nodeFactory.getMergeTarget(c.getDest())].push_back(
+            c.getSrc());
+
+    DenseSet<NodeIndex> pinned;
+    // Map from a class to the pointer the others that point to it are merged
+    // into
+    DenseMap<unsigned, NodeIndex> classReps;
+    for (auto &mapping : addrTaken) {
+      SmallVector<NodeIndex, 4> &objs = mapping.second;
+      std::sort(objs.begin(), objs.end());
+      objs.erase(std::unique(objs.begin(), objs.end()), objs.end());
+      if (objs.size() != unifier.getPointees(mapping.first).size())
+        continue;
+
+      NodeIndex ptr = mapping.first;
+      auto itr = classReps.insert(
+          std::make_pair(unifier.getPointeeClass(ptr), ptr));
+      if (!itr.second)
+        nodeFactory.mergeNode(itr.first->second, ptr);
+      pinned.insert(ptr);
+    }
+    return pinned;
+  }
+
+public:
+  UnificationOptimizer(std::vector<AndersConstraint> &c, AndersNodeFactory &n)
+      : constraints(c), nodeFactory(n), unifier(n) {
+    unifier.run(constraints);
+  }
+
+  void run() {
+    DenseSet<NodeIndex> pinned = mergePinnedPointers();
+
+    std::vector<AndersConstraint> newConstraints;
+    newConstraints.reserve(constraints.size());
+    for (auto const &c : constraints) {
+      NodeIndex destTgt = nodeFactory.getMergeTarget(c.getDest());
+      NodeIndex srcTgt = nodeFactory.getMergeTarget(c.getSrc());
+      switch (c.getType()) {
+      case AndersConstraint::ADDR_OF: {
+        // We don't want to replace src with srcTgt because, after all, the
+        // address of a variable is NOT the same as the address of another
+        // variable
+        newConstraints.emplace_back(AndersConstraint::ADDR_OF, destTgt,
+                                    c.getSrc());
+        break;
+      }
+      case AndersConstraint::COPY: {
+        if (destTgt == srcTgt || isEmpty(srcTgt) || pinned.count(destTgt))
+          break;
+        newConstraints.emplace_back(AndersConstraint::COPY, destTgt, srcTgt);
+        break;
+      }
+      case AndersConstraint::LOAD: {
+        if (isContentEmpty(srcTgt) || pinned.count(destTgt))
+          break;
+        newConstraints.emplace_back(AndersConstraint::LOAD, destTgt, srcTgt);
+        break;
+      }
+      case AndersConstraint::STORE: {
+        if (isEmpty(destTgt) || isEmpty(srcTgt))
+          break;
+        newConstraints.emplace_back(AndersConstraint::STORE, destTgt, srcTgt);
+        break;
+      }
+      }
+    }
+
+    // There may be repetitive constraints. Uniquify them
+    std::set<AndersConstraint> constraintSet(newConstraints.begin(),
+                                             newConstraints.end());
+    constraints.assign(constraintSet.begin(), constraintSet.end());
+  }
+};
+
+// Run an HVN/HU optimizer on the shared predecessor graph, building it first if
+// no one has done so. If iterate is true, keep running it until it no longer
+// merges nodes or removes constraints (this is what turns HVN into HR and HU
+// into HRU). The rounds share the graph as well: the merges and pointer facts
+// of one round are folded into it when the next one starts
+template <class OptimizerType>
+static void runOptimizer(std::vector<AndersConstraint> &constraints,
+                         AndersNodeFactory &nodeFactory,
+                         OfflineConstraintGraph &offlineGraph, bool iterate) {
+  if (!offlineGraph.isBuilt())
+    offlineGraph.build(constraints);
+
+  bool changed = true;
+  while (changed) {
+    OptimizerType opt(constraints, nodeFactory, offlineGraph);
+    opt.run();
+    changed = iterate && opt.hasChanged();
+  }
+}
+
 } // end of anonymous namespace
 
-// Optimize the constraints by performing offline variable substitution
-void Andersen::optimizeConstraints() {
+// Optimize the constraints by performing offline variable substitution.
+// None of the optimizers assume anything about what has been merged before
+// they run, so they may be combined freely. HVN is still worth running before
+// HU since it resolves first order pointer dereferences cheaply, and LE works
+// best after HVN/HU have merged the pointers that take the objects' addresses.
+// HVN and HU share offlineGraph: it is built from the constraints as they are
+// before the first optimizer runs, and the constraints the optimizers rewrite
+// keep the same solution, so the graph stays valid for the later passes
+void Andersen::optimizeConstraints(OfflineConstraintGraph &offlineGraph) {
   // errs() << "\n#constraints = " << constraints.size() << "\n";
   // dumpConstraints();
 
-  // First, let's do HVN
-  // There is an additional assumption here that before HVN, we have not merged
-  // any two nodes. Might fix that in the future
-  if (EnableHVN) {
-    HVNOptimizer hvn(constraints, nodeFactory);
-    hvn.run();
+  // The unification pre-analysis goes first, so that the others have less to
+  // look at. It leaves the offline graph alone, which is only built later
+  if (EnableUnify) {
+    UnificationOptimizer unify(constraints, nodeFactory);
+    unify.run();
   }
 
+  // First, let's do HVN (or HR)
+  if (EnableHVN || EnableHR)
+    runOptimizer<HVNOptimizer>(constraints, nodeFactory, offlineGraph,
+                               EnableHR);
+
   // nodeFactory.dumpRepInfo();
   // dumpConstraints();
 
   // errs() << "#constraints = " << constraints.size() << "\n";
 
-  // Next, do HU
-  // There is an additional assumption here that before HU, the predecessor
-  // graph will have no cycle. Might fix that in the future
-  if (EnableHU) {
-    HUOptimizer hu(constraints, nodeFactory);
-    hu.run();
-  }
+  // Next, do HU (or HRU)
+  if (EnableHU || EnableHRU)
+    runOptimizer<HUOptimizer>(constraints, nodeFactory, offlineGraph,
+                              EnableHRU);
 
   // nodeFactory.dumpRepInfo();
   // dumpConstraints();
 
   // errs() << "#constraints = " << constraints.size() << "\n";
+
+  // Finally, merge location equivalent objects
+  if (EnableLE) {
+    LEOptimizer le(constraints, nodeFactory);
+    le.run();
+  }
 }
@@ -1,16 +1,28 @@
 #include "Andersen.h"
 #include "CycleDetector.h"
-#include "SparseBitVectorGraph.h"
+#include "NodeCompactor.h"
+#include "OfflineConstraintGraph.h"
+#include "Unification.h"
 
+#include "llvm/ADT/BitVector.h"
 #include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/IntEqClasses.h"
 #include "llvm/ADT/SmallSet.h"
 #include "llvm/ADT/iterator_range.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/raw_ostream.h"
 
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <future>
 #include <map>
+#include <memory>
 #include <queue>
+#include <thread>
+#include <utility>
+#include <vector>
 
 using namespace llvm;
 
@@ -19,6 +31,31 @@ cl::opt<bool>
               cl::desc("Enable the hybrid cycle detection algorithm"));
 cl::opt<bool> EnableLCD("enable-lcd",
                         cl::desc("Enable the lazy cycle detection algorithm"));
+cl::opt<bool> EnablePKH(
+    "enable-pkh",
+    cl::desc("Enable the Pearce-Kelly-Hankin cycle detection algorithm, which "
+             "keeps the copy edges in topological order. It takes the place "
+             "of LCD"));
+cl::opt<bool> PullPropagation(
+    "pull-propagation",
+    cl::desc("Let every node pull the points-to sets of its copy predecessors, "
+             "rather than push its own set to its copy successors"));
+cl::opt<bool> PartitionSolve(
+    "partition-solve",
+    cl::desc("Split the constraints into independent parts, and solve them in "
+             "parallel"));
+cl::opt<unsigned> MinPartSize(
+    "partition-min-size",
+    cl::desc("The number of constraints a part of -partition-solve gets "
+             "before it takes no more components"),
+    cl::init(4096), cl::Hidden);
+cl::opt<bool> CompactNodes(
+    "compact-nodes",
+    cl::desc("Renumber the remaining nodes densely before solving"));
+cl::opt<bool> Steensgaard(
+    "steensgaard",
+    cl::desc("Solve the constraints by unification (Steensgaard's algorithm) "
+             "instead. This is much faster, but less precise"));
 
 namespace {
 
@@ -31,6 +68,16 @@ private:
   typedef std::set<NodeIndex> NodeSet;
   NodeSet copyEdges, loadEdges, storeEdges;
 
+  // Only kept in pull mode: the sources of the copy edges into this node, each
+  // with the version of its set that this node has pulled last. A source may
+  // have been merged into another node since
+  typedef std::vector<std::pair<NodeIndex, unsigned>> PredList;
+  PredList copyPreds;
+  // The version of the points-to set of this node, which changes whenever the
+  // set does, and the version the node has last been processed at. Versions
+  // are handed out by the ConstraintGraph, and only pull mode keeps them
+  unsigned version, processedVersion;
+
   bool insertCopyEdge(NodeIndex dst) { return copyEdges.insert(dst).second; }
   bool removeCopyEdge(NodeIndex dst) { return copyEdges.erase(dst); }
   bool insertLoadEdge(NodeIndex dst) { return loadEdges.insert(dst).second; }
@@ -45,9 +92,11 @@ private:
     copyEdges.insert(other.copyEdges.begin(), other.copyEdges.end());
     loadEdges.insert(other.loadEdges.begin(), other.loadEdges.end());
     storeEdges.insert(other.storeEdges.begin(), other.storeEdges.end());
+    copyPreds.insert(copyPreds.end(), other.copyPreds.begin(),
+                     other.copyPreds.end());
   }
 
-  ConstraintGraphNode(NodeIndex i) : idx(i) {}
+  ConstraintGraphNode(NodeIndex i) : idx(i), version(1), processedVersion(0) {}
 
 public:
   typedef NodeSet::iterator iterator;
@@ -82,6 +131,18 @@ public:
     return llvm::iterator_range<const_iterator>(store_begin(), store_end());
   }
 
+  PredList &preds() { return copyPreds; }
+
+  unsigned getVersion() const { return version; }
+  void setVersion(unsigned v) { version = v; }
+  // Record that the node is being processed. Return false if it has already
+  // been processed at the current version of its set
+  bool markProcessed() {
+    bool ret = processedVersion != version;
+    processedVersion = version;
+    return ret;
+  }
+
   friend class ConstraintGraph;
 };
 
@@ -89,12 +150,14 @@ class ConstraintGraph {
 private:
   typedef std::map<NodeIndex, ConstraintGraphNode> NodeMapTy;
   NodeMapTy graph;
+  // The last version handed out to a points-to set. Every node starts at 1
+  unsigned lastVersion;
 
 public:
   typedef NodeMapTy::iterator iterator;
   typedef NodeMapTy::const_iterator const_iterator;
 
-  ConstraintGraph() {}
+  ConstraintGraph() : lastVersion(1) {}
 
   bool insertCopyEdge(NodeIndex src, NodeIndex dst) {
     auto itr = graph.find(src);
@@ -129,6 +192,14 @@ public:
       return (itr->second).insertStoreEdge(dst);
   }
 
+  // Record the copy edge src -> dst on the side of dst, for pull mode
+  void insertCopyPred(NodeIndex src, NodeIndex dst) {
+    getOrInsertNode(dst)->copyPreds.emplace_back(src, 0);
+  }
+
+  // Return a version that no points-to set has had so far
+  unsigned getNewVersion() { return ++lastVersion; }
+
   void mergeNodes(NodeIndex dst, NodeIndex src) {
     auto itr = graph.find(src);
     if (itr == graph.end())
@@ -138,9 +209,11 @@ public:
     itr = graph.find(dst);
     if (itr == graph.end()) {
       ConstraintGraphNode dstNode(dst);
-      graph.insert(std::make_pair(dst, srcNode));
+      itr = graph.insert(std::make_pair(dst, srcNode)).first;
     } else
       (itr->second).mergeEdges(srcNode);
+    // The merged set is new to the nodes that pull from either node
+    (itr->second).setVersion(getNewVersion());
   }
 
   void deleteNode(NodeIndex idx) { graph.erase(idx); }
@@ -192,6 +265,37 @@ public:
 
 namespace {
 
+// A points-to set that has the universal object may point to anything. Such a
+// set is kept as the universal object alone: nothing can be added to it, and
+// the other objects it had don't tell anything more. The universal object has
+// the smallest object id, so it comes first in any set that has it
+bool isUniversalSet(const AndersPtsSet &set,
+                    const AndersNodeFactory &nodeFactory) {
+  return !set.isEmpty() && *set.begin() == nodeFactory.getUniversalObjId();
+}
+
+// Add the object with id objId to set. Return true if set changes
+bool insertIntoPtsSet(AndersPtsSet &set, NodeIndex objId,
+                      const AndersNodeFactory &nodeFactory) {
+  if (isUniversalSet(set, nodeFactory))
+    return false;
+  if (objId == nodeFactory.getUniversalObjId())
+    set.clear();
+  return set.insert(objId);
+}
+
+// Add the elements of src to dst. Return true if dst changes
+bool unionPtsSets(AndersPtsSet &dst, const AndersPtsSet &src,
+                  const AndersNodeFactory &nodeFactory) {
+  if (isUniversalSet(dst, nodeFactory))
+    return false;
+  if (isUniversalSet(src, nodeFactory)) {
+    dst = src;
+    return true;
+  }
+  return dst.unionWith(src);
+}
+
 void collapseNodes(NodeIndex dst, NodeIndex src, AndersNodeFactory &nodeFactory,
                    std::map<NodeIndex, AndersPtsSet> &ptsGraph,
                    ConstraintGraph &constraintGraph) {
@@ -201,7 +305,7 @@ void collapseNodes(NodeIndex dst, NodeIndex src, AndersNodeFactory &nodeFactory,
   // Node merge
   nodeFactory.mergeNode(dst, src);
   if (ptsGraph.count(src))
-    ptsGraph[dst].unionWith(ptsGraph[src]);
+    unionPtsSets(ptsGraph[dst], ptsGraph[src], nodeFactory);
   constraintGraph.mergeNodes(dst, src);
 
   // We don't need the node cycleIdx any more
@@ -216,23 +320,39 @@ private:
   std::queue<NodeIndex> list;
   // Avoid duplicate entries in FIFO queue
   llvm::SmallSet<NodeIndex, 16> set;
+  // If given, nodes come out in increasing order of (*priority)[node] rather
+  // than in FIFO order, and are kept in heap instead of list
+  const std::vector<unsigned> *priority;
+  typedef std::pair<unsigned, NodeIndex> HeapEntry;
+  std::priority_queue<HeapEntry, std::vector<HeapEntry>,
+                      std::greater<HeapEntry>>
+      heap;
 
 public:
-  AndersWorkList() {}
+  AndersWorkList(const std::vector<unsigned> *p = nullptr) : priority(p) {}
   void enqueue(NodeIndex elem) {
     if (!set.count(elem)) {
-      list.push(elem);
+      if (priority)
+        heap.emplace((*priority)[elem], elem);
+      else
+        list.push(elem);
       set.insert(elem);
     }
   }
   NodeIndex dequeue() {
-    assert(!list.empty() && "Trying to dequeue an empty queue!");
-    NodeIndex ret = list.front();
-    list.pop();
+    assert(!isEmpty() && "Trying to dequeue an empty queue!");
+    NodeIndex ret;
+    if (priority) {
+      ret = heap.top().second;
+      heap.pop();
+    } else {
+      ret = list.front();
+      list.pop();
+    }
     set.erase(ret);
     return ret;
   }
-  bool isEmpty() const { return list.empty(); }
+  bool isEmpty() const { return list.empty() && heap.empty(); }
 };
 
 // The technique used here is described in "The Ant and the Grasshopper: Fast
@@ -241,13 +361,15 @@ public:
 // "HCD" (Hybrid Cycle Detection) algorithm. It is called a hybrid because it
 // performs an offline analysis and uses its results during the solving (online)
 // phase. This is just the offline portion
-class OfflineCycleDetector : public CycleDetector<SparseBitVectorGraph> {
+class OfflineCycleDetector : public CycleDetector<OfflineGraphView<false>> {
 private:
   // The node factory
   AndersNodeFactory &nodeFactory;
 
-  // The offline constraint graph
-  SparseBitVectorGraph offlineGraph;
+  // The offline constraint graph, shared with the offline optimizations. It is
+  // in the predecessor direction, which doesn't matter since reversing the
+  // edges doesn't change the cycles
+  OfflineConstraintGraph &offlineGraph;
   // If a mapping <p, q> is in this map, it means that *p and q are in the same
   // cycle in the offline constraint graph, and anything that p points to during
   // the online constraint solving phase can be immediately collapse with q
@@ -257,39 +379,8 @@ private:
   // Used to collect the scc nodes on a cycle
   SparseBitVector<> scc;
 
-  // Return the node index of the "ref node" (used to represent *n) of n.
-  // We won't actually create that ref node. We cannot use the NodeIndex of that
-  // refNode to index into nodeFactory
-  NodeIndex getRefNodeIndex(NodeIndex n) const {
-    return n + nodeFactory.getNumNodes();
-  }
-
-  void buildOfflineConstraintGraph(
-      const std::vector<AndersConstraint> &constraints) {
-    for (auto const &c : constraints) {
-      NodeIndex srcTgt = nodeFactory.getMergeTarget(c.getSrc());
-      NodeIndex dstTgt = nodeFactory.getMergeTarget(c.getDest());
-      switch (c.getType()) {
-      case AndersConstraint::ADDR_OF:
-        break;
-      case AndersConstraint::LOAD: {
-        offlineGraph.insertEdge(getRefNodeIndex(srcTgt), dstTgt);
-        break;
-      }
-      case AndersConstraint::STORE: {
-        offlineGraph.insertEdge(srcTgt, getRefNodeIndex(dstTgt));
-        break;
-      }
-      case AndersConstraint::COPY: {
-        offlineGraph.insertEdge(srcTgt, dstTgt);
-        break;
-      }
-      }
-    }
-  }
-
   NodeType *getRep(NodeIndex idx) override {
-    return offlineGraph.getOrInsertNode(idx);
+    return offlineGraph.getNode(offlineGraph.getMergeTarget(idx));
   }
 
   // Specify how to process the non-rep nodes if a cycle is found
@@ -308,11 +399,11 @@ private:
 
     // The representative is the first non-ref node
     NodeIndex repNode = scc.find_first();
-    assert(repNode < nodeFactory.getNumNodes() &&
+    assert(offlineGraph.isVarNode(repNode) &&
            "The SCC didn't have a non-Ref node!");
     for (auto itr = ++scc.begin(), ite = scc.end(); itr != ite; ++itr) {
       NodeIndex cycleNode = *itr;
-      if (cycleNode > nodeFactory.getNumNodes())
+      if (offlineGraph.isRefNode(cycleNode))
         // For REF nodes, insert it to the collapse map
         collapseMap[cycleNode - nodeFactory.getNumNodes()] = repNode;
       else
@@ -325,15 +416,14 @@ private:
   }
 
 public:
-  OfflineCycleDetector(const std::vector<AndersConstraint> &cs,
-                       AndersNodeFactory &n)
-      : nodeFactory(n) {
-    // Build the offline constraint graph first before we move on
-    buildOfflineConstraintGraph(cs);
-  }
+  OfflineCycleDetector(OfflineConstraintGraph &g, AndersNodeFactory &n)
+      : nodeFactory(n), offlineGraph(g) {}
 
   void run() override {
-    runOnGraph(&offlineGraph);
+    // Only the edges from copy, load and store constraints are followed here
+    offlineGraph.updateMerges();
+    OfflineGraphView<false> graphView(offlineGraph);
+    runOnGraph(&graphView);
 
     // Merge the nodes in mergeMap
     for (auto const &mapping : mergeMap)
@@ -346,13 +436,32 @@ public:
     releaseSCCMemory();
   }
 
-  // Return InvalidIndex if no collapse target found
-  NodeIndex getCollapseTarget(NodeIndex n) {
-    auto itr = collapseMap.find(n);
-    if (itr == collapseMap.end())
-      return AndersNodeFactory::InvalidIndex;
-    else
-      return itr->second;
+  const DenseMap<NodeIndex, NodeIndex> &getCollapseMap() const {
+    return collapseMap;
+  }
+
+  // Return the collapse map in terms of the compact nodes of compactor.
+  // A pointer that has been merged into another one is never looked up, and
+  // neither is one without a compact node. A collapse target gets a compact
+  // node, so it may bring its own collapse target in with it. This only reads
+  // the collapse map, so it may run for several compactors at once
+  DenseMap<NodeIndex, NodeIndex>
+  getCompactCollapseMap(AndersNodeCompactor &compactor) const {
+    DenseMap<NodeIndex, NodeIndex> compactMap;
+    bool isChanged = true;
+    while (isChanged) {
+      isChanged = false;
+      for (auto const &mapping : collapseMap) {
+        if (nodeFactory.getMergeTarget(mapping.first) != mapping.first)
+          continue;
+        NodeIndex ptr = compactor.getCompactNode(mapping.first);
+        if (ptr == AndersNodeFactory::InvalidIndex || compactMap.count(ptr))
+          continue;
+        compactMap[ptr] = compactor.getOrCreateCompactNode(mapping.second);
+        isChanged = true;
+      }
+    }
+    return compactMap;
   }
 };
 
@@ -367,8 +476,9 @@ void buildConstraintGraph(ConstraintGraph &cGraph,
     case AndersConstraint::ADDR_OF: {
       // We don't want to replace src with srcTgt because, after all, the
       // address of a variable is NOT the same as the address of another
-      // variable
-      ptsGraph[dstTgt].insert(c.getSrc());
+      // variable. Points-to sets hold object ids rather than node indices
+      insertIntoPtsSet(ptsGraph[dstTgt], nodeFactory.getObjectId(c.getSrc()),
+                       nodeFactory);
       break;
     }
     case AndersConstraint::LOAD: {
@@ -385,6 +495,23 @@ void buildConstraintGraph(ConstraintGraph &cGraph,
     }
     }
   }
+
+  // A pointer that may point to anything has the universal object alone in
+  // its set, so the solver turns its stores into stores into the universal
+  // object. They may have been meant for any object, so every object holds
+  // what the universal object holds. This is done on the objects rather than
+  // on the loads because the offline optimizations turn some loads into
+  // copies out of objects
+  NodeIndex univObj = nodeFactory.getMergeTarget(
+      nodeFactory.getUniversalObjNode());
+  for (NodeIndex id = nodeFactory.getUniversalObjId() + 1,
+                 e = nodeFactory.getNumObjects();
+       id < e; ++id) {
+    NodeIndex objTgt =
+        nodeFactory.getMergeTarget(nodeFactory.getObjectNodeWithId(id));
+    if (objTgt != univObj)
+      cGraph.insertCopyEdge(univObj, objTgt);
+  }
 }
 
 class OnlineCycleDetector : public CycleDetector<ConstraintGraph> {
@@ -393,6 +520,9 @@ private:
   ConstraintGraph &constraintGraph;
   std::map<NodeIndex, AndersPtsSet> &ptsGraph;
   const DenseSet<NodeIndex> &candidates;
+  // The node each collapsed node has been merged into, one entry per
+  // collapsed node
+  std::vector<NodeIndex> collapseTargets;
 
   NodeType *getRep(NodeIndex idx) override {
     return constraintGraph.getOrInsertNode(nodeFactory.getMergeTarget(idx));
@@ -406,6 +536,8 @@ private:
     // "\n";
 
     collapseNodes(repIdx, cycleIdx, nodeFactory, ptsGraph, constraintGraph);
+    if (repIdx != cycleIdx)
+      collapseTargets.push_back(repIdx);
   }
   // Specify how to process the rep nodes if a cycle is found
   void processCycleRepNode(const NodeType *node) override {
@@ -423,52 +555,528 @@ public:
     for (auto node : candidates)
       runOnNode(node);
   }
+
+  const std::vector<NodeIndex> &getCollapseTargets() const {
+    return collapseTargets;
+  }
+  using CycleDetector::getNumVisitedNodes;
 };
 
-} // end of anonymous namespace
+// LCD decides which nodes to check for cycles, and when to check them.
+// A copy edge whose source and target have the same points-to set may be on a
+// cycle, so its target becomes a candidate. The edge is only looked at when
+// propagating along it left the target unchanged, i.e. when the target already
+// holds everything the source has. The two sets are then equal exactly when
+// their sizes are, so the sizes serve as fingerprints. They are cached until
+// the set changes, which makes the check a couple of lookups per edge. A node
+// becomes a candidate at most once while its set keeps the same size, much
+// like the paper checks every edge only once.
+// A detection run does a DFS from the candidates, which is wasted work unless
+// it finds cycles. A run that collapses too few nodes for the nodes it visits
+// doubles the number of iterations until the next run, up to a limit, and a
+// run that pays off brings it back to every iteration. Candidates wait for the
+// next run in the meantime.
+class LazyCycleDetector {
+private:
+  AndersNodeFactory &nodeFactory;
+  ConstraintGraph &constraintGraph;
+  std::map<NodeIndex, AndersPtsSet> &ptsGraph;
 
-/// solveConstraints - This stage iteratively processes the constraints list
-/// propagating constraints (adding edges to the Nodes in the points-to graph)
-/// until a fixed point is reached.
-///
-/// We use a variant of the technique called "Lazy Cycle Detection", which is
-/// described in "The Ant and the Grasshopper: Fast and Accurate Pointer
-/// Analysis for Millions of Lines of Code. In Programming Language Design and
-/// Implementation (PLDI), June 2007."
-/// The paper describes performing cycle detection one node at a time, which can
-/// be expensive if there are no cycles, but there are long chains of nodes that
-/// it heuristically believes are cycles (because it will DFS from each node
-/// without state from previous nodes).
-/// Instead, we use the heuristic to build a worklist of nodes to check, then
-/// cycle detect them all at the same time to do this more cheaply.  This
-/// catches cycles slightly later than the original technique did, but does it
-/// make significantly cheaper.
-void Andersen::solveConstraints() {
-  // We'll do offline HCD first
-  OfflineCycleDetector offlineInfo(constraints, nodeFactory);
-  if (EnableHCD)
-    offlineInfo.run();
+  static const unsigned UnknownSize = ~0u;
+  // A run pays off if it collapses a node for every MaxVisitsPerCollapse nodes
+  // it visits
+  static const unsigned MaxVisitsPerCollapse = 32;
+  // The most iterations from one run to the next
+  static const unsigned MaxInterval = 64;
+
+  // The size of the points-to set of every node, or UnknownSize if it hasn't
+  // been counted since the set last changed
+  std::vector<unsigned> setSizes;
+  // The size the set of every node had when it last became a candidate, or
+  // UnknownSize if it never did
+  std::vector<unsigned> checkedSizes;
+  // The nodes that might be on a cycle
+  DenseSet<NodeIndex> candidates;
+  // The iterations from one run to the next, and the ones left until the next
+  unsigned interval, countdown;
+
+  unsigned getSetSize(NodeIndex node, const AndersPtsSet &ptsSet) {
+    unsigned &size = setSizes[node];
+    if (size == UnknownSize)
+      size = ptsSet.getSize();
+    return size;
+  }
+
+public:
+  LazyCycleDetector(AndersNodeFactory &n, ConstraintGraph &co,
+                    std::map<NodeIndex, AndersPtsSet> &p)
+      : nodeFactory(n), constraintGraph(co), ptsGraph(p), interval(1),
+        countdown(1) {}
+
+  void init() {
+    setSizes.assign(nodeFactory.getNumNodes(), UnknownSize);
+    checkedSizes.assign(nodeFactory.getNumNodes(), UnknownSize);
+  }
+
+  // Tell the detector that the points-to set of node has changed
+  void setChanged(NodeIndex node) { setSizes[node] = UnknownSize; }
+
+  // Look at the copy edge src -> dst, along which propagation has left dst
+  // unchanged
+  void checkEdge(NodeIndex src, const AndersPtsSet &srcSet, NodeIndex dst,
+                 const AndersPtsSet &dstSet) {
+    unsigned size = getSetSize(dst, dstSet);
+    if (checkedSizes[dst] == size || getSetSize(src, srcSet) != size)
+      return;
+    checkedSizes[dst] = size;
+    candidates.insert(dst);
+  }
+
+  // Detect and collapse the cycles through the candidates, if it is time to.
+  // This is called at the start of every iteration
+  void run() {
+    if (countdown > 0)
+      --countdown;
+    if (countdown > 0 || candidates.empty())
+      return;
+
+    OnlineCycleDetector cycleDetector(nodeFactory, constraintGraph, ptsGraph,
+                                      candidates);
+    cycleDetector.run();
+    candidates.clear();
+    for (auto node : cycleDetector.getCollapseTargets())
+      setChanged(nodeFactory.getMergeTarget(node));
+
+    unsigned numCollapsed = cycleDetector.getCollapseTargets().size();
+    if (numCollapsed * MaxVisitsPerCollapse >=
+        cycleDetector.getNumVisitedNodes())
+      interval = 1;
+    else if (interval < MaxInterval)
+      interval *= 2;
+    countdown = interval;
+  }
+};
+
+const unsigned LazyCycleDetector::UnknownSize;
+
+// The technique used here is described in "Online Cycle Detection and
+// Difference Propagation for Pointer Analysis. In the 3rd International
+// Workshop on Source Code Analysis and Manipulation (SCAM), September 2003."
+// It keeps the copy edges in a topological order with Pearce and Kelly's
+// dynamic topological sort, so it is known here as "PKH". When an edge x -> y
+// goes backward in the order, only the nodes ordered between y and x can be
+// affected: the ones reachable from y are searched forward, the ones reaching x
+// backward, and the former are moved after the latter. If the forward search
+// gets to x, the edge has closed a cycle. Every node on a path from y to x is
+// on it, and they are collapsed right away.
+// The solver adds copy edges while it walks the edges of a node, where nodes
+// can't be collapsed, so new edges wait until it is done with the node. The
+// order is only kept for the edges that have been checked, which is what the
+// searches rely on.
+class TopoOrderCycleDetector {
+private:
+  AndersNodeFactory &nodeFactory;
+  ConstraintGraph &constraintGraph;
+  std::map<NodeIndex, AndersPtsSet> &ptsGraph;
+
+  // The position of every representative in the topological order. Positions
+  // are unique, but may have gaps
+  std::vector<unsigned> order;
+  // The copy edges checked so far, both ways. Their nodes may have been merged
+  // into others since
+  std::vector<std::vector<NodeIndex>> succs, preds;
+  // The copy edges that are not checked yet
+  std::vector<std::pair<NodeIndex, NodeIndex>> pendingEdges;
+
+  // The marks of the searches. A node is visited by the forward (backward)
+  // search of the current check iff its forward (backward) mark is currMark,
+  // and reaches the tail of the edge iff its reach mark is currMark
+  std::vector<unsigned> forwardMarks, backwardMarks, reachMarks;
+  unsigned currMark;
+  std::vector<NodeIndex> forwardNodes, backwardNodes;
+
+  // Visit the nodes reachable from head, up to the position of tail, and find
+  // out which of them reach tail. Tail isn't searched past: the only way out
+  // of it that goes back to lower positions is the new edge
+  void searchForward(NodeIndex head, NodeIndex tail) {
+    unsigned upperBound = order[tail];
+    std::vector<std::pair<NodeIndex, unsigned>> stack;
+    auto visit = [&](NodeIndex n) {
+      forwardMarks[n] = currMark;
+      forwardNodes.push_back(n);
+      if (n == tail)
+        reachMarks[n] = currMark;
+      else
+        stack.emplace_back(n, 0);
+    };
+
+    visit(head);
+    while (!stack.empty()) {
+      NodeIndex n = stack.back().first;
+      unsigned i = stack.back().second++;
+      if (i == succs[n].size()) {
+        // n is done, and so are all its successors since the edges checked so
+        // far have no cycles
+        stack.pop_back();
+        if (!stack.empty() && reachMarks[n] == currMark)
+          reachMarks[stack.back().first] = currMark;
+        continue;
+      }
+
+      NodeIndex succ = nodeFactory.getMergeTarget(succs[n][i]);
+      if (succ == n)
+        continue;
+      if (forwardMarks[succ] != currMark) {
+        if (order[succ] > upperBound)
+          continue;
+        visit(succ);
+      }
+      if (reachMarks[succ] == currMark)
+        reachMarks[n] = currMark;
+    }
+  }
+
+  // Visit the nodes that reach tail, down to the position of head
+  void searchBackward(NodeIndex tail, NodeIndex head) {
+    unsigned lowerBound = order[head];
+    std::vector<NodeIndex> stack;
+    backwardMarks[tail] = currMark;
+    backwardNodes.push_back(tail);
+    stack.push_back(tail);
+    while (!stack.empty()) {
+      NodeIndex n = stack.back();
+      stack.pop_back();
+      for (auto p : preds[n]) {
+        NodeIndex pred = nodeFactory.getMergeTarget(p);
+        if (backwardMarks[pred] == currMark || order[pred] < lowerBound)
+          continue;
+        backwardMarks[pred] = currMark;
+        backwardNodes.push_back(pred);
+        stack.push_back(pred);
+      }
+    }
+  }
+
+  // Drop the merged nodes, the duplicates and n itself from the edges of n
+  void compactEdges(NodeIndex n, std::vector<NodeIndex> &edges) {
+    for (auto &e : edges)
+      e = nodeFactory.getMergeTarget(e);
+    std::sort(edges.begin(), edges.end());
+    edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+    edges.erase(std::remove(edges.begin(), edges.end(), n), edges.end());
+  }
+
+  // Check the copy edge tail -> head against the order. Return the node the
+  // cycle it closes is collapsed into, or InvalidIndex if it closes none
+  NodeIndex checkEdge(NodeIndex tail, NodeIndex head) {
+    tail = nodeFactory.getMergeTarget(tail);
+    head = nodeFactory.getMergeTarget(head);
+    if (tail == head)
+      return AndersNodeFactory::InvalidIndex;
+    succs[tail].push_back(head);
+    preds[head].push_back(tail);
+    if (order[tail] < order[head])
+      return AndersNodeFactory::InvalidIndex;
+
+    ++currMark;
+    forwardNodes.clear();
+    backwardNodes.clear();
+    searchForward(head, tail);
+    searchBackward(tail, head);
+    bool isCycle = forwardMarks[tail] == currMark;
+
+    // The nodes on the cycle reach tail and are reachable from head, so they
+    // are found by both searches. The others keep their relative order, and
+    // the ones that reach tail go first
+    auto onCycle = [&](NodeIndex n) { return reachMarks[n] == currMark; };
+    auto byOrder = [&](NodeIndex a, NodeIndex b) {
+      return order[a] < order[b];
+    };
+    std::vector<unsigned> positions;
+    for (auto n : backwardNodes)
+      positions.push_back(order[n]);
+    for (auto n : forwardNodes)
+      if (backwardMarks[n] != currMark)
+        positions.push_back(order[n]);
+    std::sort(positions.begin(), positions.end());
+
+    std::vector<NodeIndex> newOrder;
+    for (auto n : backwardNodes)
+      if (!onCycle(n))
+        newOrder.push_back(n);
+    std::sort(newOrder.begin(), newOrder.end(), byOrder);
+    if (isCycle)
+      newOrder.push_back(tail);
+    unsigned numBefore = newOrder.size();
+    for (auto n : forwardNodes)
+      if (!onCycle(n))
+        newOrder.push_back(n);
+    std::sort(newOrder.begin() + numBefore, newOrder.end(), byOrder);
+
+    // The cycle takes a single position, so some positions are left unused.
+    // They are left between the two halves, so that no node reachable from
+    // head moves down, and no node reaching tail moves up
+    unsigned numAfter = newOrder.size() - numBefore;
+    for (unsigned i = 0; i < numBefore; ++i)
+      order[newOrder[i]] = positions[i];
+    unsigned firstAfter = positions.size() - numAfter;
+    for (unsigned i = 0; i < numAfter; ++i)
+      order[newOrder[numBefore + i]] = positions[firstAfter + i];
+
+    if (!isCycle)
+      return AndersNodeFactory::InvalidIndex;
+
+    for (auto n : forwardNodes) {
+      if (n == tail || !onCycle(n))
+        continue;
+      collapseNodes(tail, n, nodeFactory, ptsGraph, constraintGraph);
+      succs[tail].insert(succs[tail].end(), succs[n].begin(), succs[n].end());
+      preds[tail].insert(preds[tail].end(), preds[n].begin(), preds[n].end());
+      std::vector<NodeIndex>().swap(succs[n]);
+      std::vector<NodeIndex>().swap(preds[n]);
+    }
+    compactEdges(tail, succs[tail]);
+    compactEdges(tail, preds[tail]);
+    return tail;
+  }
+
+public:
+  TopoOrderCycleDetector(AndersNodeFactory &n, ConstraintGraph &co,
+                         std::map<NodeIndex, AndersPtsSet> &p)
+      : nodeFactory(n), constraintGraph(co), ptsGraph(p), currMark(0) {}
+
+  // Order the nodes of the constraint graph built so far, and check its copy
+  // edges. Nodes that are not in the constraint graph go last
+  void init() {
+    unsigned numNodes = nodeFactory.getNumNodes();
+    order.assign(numNodes, 0);
+    succs.resize(numNodes);
+    preds.resize(numNodes);
+    forwardMarks.assign(numNodes, 0);
+    backwardMarks.assign(numNodes, 0);
+    reachMarks.assign(numNodes, 0);
+
+    // Start from the reverse postorder of a depth first search, under which
+    // only the edges that close cycles go backward
+    std::vector<NodeIndex> postOrder;
+    BitVector visited(numNodes);
+    std::vector<std::pair<NodeIndex, ConstraintGraphNode::iterator>> stack;
+    for (auto &mapping : constraintGraph) {
+      for (auto dst : mapping.second)
+        pendingEdges.emplace_back(mapping.first, dst);
+      if (visited.test(mapping.first))
+        continue;
+
+      visited.set(mapping.first);
+      stack.emplace_back(mapping.first, mapping.second.begin());
+      while (!stack.empty()) {
+        NodeIndex n = stack.back().first;
+        auto &itr = stack.back().second;
+        ConstraintGraphNode *cNode = constraintGraph.getNodeWithIndex(n);
+        if (itr == cNode->end()) {
+          postOrder.push_back(n);
+          stack.pop_back();
+          continue;
+        }
+        NodeIndex succ = *itr++;
+        if (visited.test(succ))
+          continue;
+        visited.set(succ);
+        ConstraintGraphNode *succNode = constraintGraph.getNodeWithIndex(succ);
+        if (succNode == nullptr)
+          postOrder.push_back(succ);
+        else
+          stack.emplace_back(succ, succNode->begin());
+      }
+    }
+
+    unsigned pos = 0;
+    for (auto itr = postOrder.rbegin(), ite = postOrder.rend(); itr != ite;
+         ++itr)
+      order[*itr] = pos++;
+    for (NodeIndex i = 0; i < numNodes; ++i)
+      if (!visited.test(i))
+        order[i] = pos++;
+  }
+
+  const std::vector<unsigned> &getOrder() const { return order; }
+
+  // Remember that the copy edge src -> dst has been added to the constraint
+  // graph
+  void addEdge(NodeIndex src, NodeIndex dst) {
+    pendingEdges.emplace_back(src, dst);
+  }
+
+  // Check the copy edges added since the last call, collapsing the cycles they
+  // close. The nodes the cycles are collapsed into are put on workList
+  void processPendingEdges(AndersWorkList &workList) {
+    for (unsigned i = 0; i < pendingEdges.size(); ++i) {
+      NodeIndex rep =
+          checkEdge(pendingEdges[i].first, pendingEdges[i].second);
+      if (rep != AndersNodeFactory::InvalidIndex)
+        workList.enqueue(rep);
+    }
+    pendingEdges.clear();
+  }
+};
+
+// How a solve has used the nodes that all the parts of a partitioned solve
+// share: the special nodes, and the nodes merged with them
+struct SharedNodeUse {
+  // Something has been stored into the universal object, or into the null
+  // object
+  bool writesUniversal, writesNull;
+  // Something has been copied out of the null object, or loaded or stored
+  // through what it points to. The offline optimizations merge the pointers
+  // that point to nothing with it
+  bool readsNull;
+  // Nodes have been merged into the shared ones, or the other way around
+  bool mergesShared;
+};
+
+// Put the representatives of the special nodes into reps
+void getSharedReps(AndersNodeFactory &nodeFactory,
+                   SmallSet<NodeIndex, 4> &reps) {
+  for (NodeIndex node :
+       {nodeFactory.getUniversalPtrNode(), nodeFactory.getUniversalObjNode(),
+        nodeFactory.getNullPtrNode(), nodeFactory.getNullObjectNode()})
+    reps.insert(nodeFactory.getMergeTarget(node));
+}
+
+// Return the number of nodes merged with the special nodes (the special nodes
+// included), and the number of representatives they have
+std::pair<unsigned, unsigned> countSharedNodes(AndersNodeFactory &nodeFactory) {
+  SmallSet<NodeIndex, 4> sharedReps;
+  getSharedReps(nodeFactory, sharedReps);
+  unsigned numShared = 0;
+  for (NodeIndex i = 0, e = nodeFactory.getNumNodes(); i < e; ++i)
+    if (sharedReps.count(nodeFactory.getMergeTarget(i)))
+      ++numShared;
+  return std::make_pair(numShared, sharedReps.size());
+}
+
+// Solve constraints into ptsGraph. Their nodes live in solverFactory, where
+// the nodes that get collapsed are merged. HCD looks the collapse targets up
+// in collapseMap, which refers to the same nodes. If use is given, it is told
+// how the solve has used the shared nodes
+void solveConstraintSet(std::vector<AndersConstraint> &constraints,
+                        AndersNodeFactory &solverFactory,
+                        const DenseMap<NodeIndex, NodeIndex> &collapseMap,
+                        std::map<NodeIndex, AndersPtsSet> &ptsGraph,
+                        SharedNodeUse *use = nullptr) {
+  std::pair<unsigned, unsigned> sharedBefore;
+  if (use)
+    sharedBefore = countSharedNodes(solverFactory);
 
   // Now build the constraint graph
   ConstraintGraph constraintGraph;
-  buildConstraintGraph(constraintGraph, constraints, nodeFactory, ptsGraph);
+  buildConstraintGraph(constraintGraph, constraints, solverFactory, ptsGraph);
   // The constraint vector is useless now
   constraints.clear();
 
+  // PKH keeps the copy edges in topological order from here on, and the work
+  // lists hand the nodes out in that order
+  TopoOrderCycleDetector topoOrder(solverFactory, constraintGraph, ptsGraph);
+  const std::vector<unsigned> *priority = nullptr;
+  if (EnablePKH) {
+    topoOrder.init();
+    priority = &topoOrder.getOrder();
+  }
+  // LCD would collapse nodes behind PKH's back, and PKH finds every cycle
+  // anyway
+  bool useLCD = EnableLCD && !EnablePKH;
+  LazyCycleDetector lazyCycles(solverFactory, constraintGraph, ptsGraph);
+  if (useLCD)
+    lazyCycles.init();
+  // Add a copy edge to the constraint graph. Return true if it is new
+  auto insertCopyEdge = [&](NodeIndex src, NodeIndex dst) {
+    if (!constraintGraph.insertCopyEdge(src, dst))
+      return false;
+    if (EnablePKH)
+      topoOrder.addEdge(src, dst);
+    if (PullPropagation)
+      constraintGraph.insertCopyPred(src, dst);
+    return true;
+  };
+
+  // In pull mode, every node keeps the copy edges into it as well
+  if (PullPropagation) {
+    for (auto &mapping : constraintGraph)
+      for (auto dst : mapping.second)
+        constraintGraph.insertCopyPred(mapping.first, dst);
+  }
+
+  // In pull mode, a node brings its own set up to date, from the sources of its
+  // copy edges whose sets have changed since it last looked. The sources are
+  // read one after another, and only the set of the node is written, however
+  // many of them have changed. Return false if the set is the same as the
+  // last time the node was processed, in which case there is nothing to do
+  auto pullPtsSet = [&](NodeIndex node, ConstraintGraphNode &cNode) {
+    auto &preds = cNode.preds();
+    bool isChanged = false, isRenamed = false;
+    for (auto &pred : preds) {
+      NodeIndex predRep = solverFactory.getMergeTarget(pred.first);
+      if (predRep != pred.first) {
+        pred.first = predRep;
+        isRenamed = true;
+      }
+      if (predRep == node)
+        continue;
+      ConstraintGraphNode *predNode = constraintGraph.getNodeWithIndex(predRep);
+      assert(predNode != nullptr && "The source of a copy edge is gone?");
+      if (predNode->getVersion() == pred.second)
+        continue;
+      pred.second = predNode->getVersion();
+
+      auto predItr = ptsGraph.find(predRep);
+      if (predItr == ptsGraph.end())
+        continue;
+      AndersPtsSet &ptsSet = ptsGraph[node];
+      if (unionPtsSets(ptsSet, predItr->second, solverFactory))
+        isChanged = true;
+      else if (useLCD)
+        lazyCycles.checkEdge(predRep, predItr->second, node, ptsSet);
+    }
+
+    // Merged nodes leave duplicate sources and edges from the node itself
+    // behind. Of the duplicates, keep the one that has been pulled least
+    // recently
+    if (isRenamed) {
+      std::sort(preds.begin(), preds.end());
+      auto sameSource = [](const std::pair<NodeIndex, unsigned> &a,
+                           const std::pair<NodeIndex, unsigned> &b) {
+        return a.first == b.first;
+      };
+      auto isSelf = [node](const std::pair<NodeIndex, unsigned> &p) {
+        return p.first == node;
+      };
+      preds.erase(std::unique(preds.begin(), preds.end(), sameSource),
+                  preds.end());
+      preds.erase(std::remove_if(preds.begin(), preds.end(), isSelf),
+                  preds.end());
+    }
+
+    if (isChanged) {
+      cNode.setVersion(constraintGraph.getNewVersion());
+      if (useLCD)
+        lazyCycles.setChanged(node);
+    }
+    return cNode.markProcessed();
+  };
+
   // We switch between two work lists instead of relying on only one work list
-  AndersWorkList workList1, workList2;
+  AndersWorkList workList1(priority), workList2(priority);
   // The "current" and the "next" work list
   AndersWorkList *currWorkList = &workList1, *nextWorkList = &workList2;
-  // The set of nodes that LCD believes might be on a cycle
-  DenseSet<NodeIndex> cycleCandidates;
-  // The set of edges that LCD believes not on a cycle
-  DenseSet<std::pair<NodeIndex, NodeIndex>> checkedEdges;
+
+  if (EnablePKH)
+    topoOrder.processPendingEdges(*currWorkList);
 
   // Scan the node list, add it to work list if the node a representative and
   // can contribute to the calculation right now.
   for (auto const &mapping : ptsGraph) {
     NodeIndex node = mapping.first;
-    if (nodeFactory.getMergeTarget(node) == node &&
+    if (solverFactory.getMergeTarget(node) == node &&
         constraintGraph.getNodeWithIndex(node) != nullptr)
       currWorkList->enqueue(node);
   }
@@ -477,53 +1085,80 @@ void Andersen::solveConstraints() {
     // Iteration begins
 
     // First we've got to check if there is any cycle candidates in the last
-    // iteration. If there is, detect and collapse cycle
-    if (EnableLCD && !cycleCandidates.empty()) {
-      // Detect and collapse cycles online
-      OnlineCycleDetector cycleDetector(nodeFactory, constraintGraph, ptsGraph,
-                                        cycleCandidates);
-      cycleDetector.run();
-      cycleCandidates.clear();
-    }
+    // iterations. If there is, detect and collapse cycle
+    if (useLCD)
+      lazyCycles.run();
 
     while (!currWorkList->isEmpty()) {
+      // Collapse the cycles closed by the copy edges the last node added
+      if (EnablePKH)
+        topoOrder.processPendingEdges(*nextWorkList);
+
       NodeIndex node = currWorkList->dequeue();
-      node = nodeFactory.getMergeTarget(node);
+      node = solverFactory.getMergeTarget(node);
       // errs() << "Examining node " << node << "\n";
 
       ConstraintGraphNode *cNode = constraintGraph.getNodeWithIndex(node);
       if (cNode == nullptr)
         continue;
+      if (PullPropagation && !pullPtsSet(node, *cNode))
+        continue;
 
       auto ptsItr = ptsGraph.find(node);
       if (ptsItr != ptsGraph.end()) {
         // Check indirect constraints and add copy edge to the constraint graph
         // if necessary
         const AndersPtsSet &ptsSet = ptsItr->second;
+        bool pointsToAnything = isUniversalSet(ptsSet, solverFactory);
 
         // This is where we perform HCD: check if node has a collapse target,
-        // and if it does, merge them immediately
-        if (EnableHCD) {
-          NodeIndex collapseTarget = offlineInfo.getCollapseTarget(node);
-          if (collapseTarget != AndersNodeFactory::InvalidIndex) {
+        // and if it does, merge them immediately. A node that may point to
+        // anything would collapse everything, so leave it to LCD
+        if (EnableHCD && !pointsToAnything) {
+          auto ctItr = collapseMap.find(node);
+          NodeIndex collapseTarget = ctItr == collapseMap.end()
+                                         ? AndersNodeFactory::InvalidIndex
+                                         : ctItr->second;
+          if (collapseTarget != AndersNodeFactory::InvalidIndex && EnablePKH) {
+            // Merging the nodes here would break PKH's order. Tie them
+            // together with copy edges both ways instead, and let PKH
+            // collapse the cycle
+            NodeIndex ctRep = solverFactory.getMergeTarget(collapseTarget);
+            for (auto v : ptsSet) {
+              NodeIndex vRep = solverFactory.getMergeTarget(
+                  solverFactory.getObjectNodeWithId(v));
+              if (vRep != ctRep) {
+                insertCopyEdge(ctRep, vRep);
+                insertCopyEdge(vRep, ctRep);
+              }
+            }
+          } else if (collapseTarget != AndersNodeFactory::InvalidIndex) {
             // errs() << "node = " << node << ", collapseTgt = " <<
             // collapseTarget << "\n";
-            NodeIndex ctRep = nodeFactory.getMergeTarget(collapseTarget);
+            NodeIndex ctRep = solverFactory.getMergeTarget(collapseTarget);
             // Here we have to pay special attention to whether the node
             // points-to itself.
             bool mergeSelf = false;
             for (auto v : ptsSet) {
-              NodeIndex vRep = nodeFactory.getMergeTarget(v);
+              NodeIndex vRep = solverFactory.getMergeTarget(
+                  solverFactory.getObjectNodeWithId(v));
               if (vRep == node) {
                 mergeSelf = true;
                 continue;
               }
-              collapseNodes(ctRep, vRep, nodeFactory, ptsGraph,
+              collapseNodes(ctRep, vRep, solverFactory, ptsGraph,
                             constraintGraph);
             }
 
+            if (useLCD)
+              lazyCycles.setChanged(ctRep);
+            // In pull mode, the nodes after ctRep only get what it has just
+            // got if it is processed again
+            if (PullPropagation)
+              nextWorkList->enqueue(ctRep);
+
             if (mergeSelf) {
-              collapseNodes(ctRep, node, nodeFactory, ptsGraph,
+              collapseNodes(ctRep, node, solverFactory, ptsGraph,
                             constraintGraph);
               // If the node collapsing succeeds, we can't proceed here because
               // node no longer exists. Push ctRep to the worklist and proceed
@@ -535,18 +1170,33 @@ void Andersen::solveConstraints() {
           }
         }
 
+        // A load through a pointer that may point to anything may load
+        // anything. Its stores go into the universal object in the loop below
+        if (pointsToAnything) {
+          NodeIndex univPtr =
+              solverFactory.getMergeTarget(solverFactory.getUniversalPtrNode());
+          for (auto const &dst : cNode->loads()) {
+            NodeIndex tgtNode = solverFactory.getMergeTarget(dst);
+            if (insertCopyEdge(univPtr, tgtNode))
+              nextWorkList->enqueue(PullPropagation ? tgtNode : univPtr);
+          }
+        }
+
         for (auto v : ptsSet) {
           DenseMap<NodeIndex, NodeIndex> updateMap;
 
-          NodeIndex vRep = nodeFactory.getMergeTarget(v);
+          NodeIndex vRep = solverFactory.getMergeTarget(
+              solverFactory.getObjectNodeWithId(v));
           for (auto const &dst : cNode->loads()) {
-            NodeIndex tgtNode = nodeFactory.getMergeTarget(dst);
+            NodeIndex tgtNode = solverFactory.getMergeTarget(dst);
             // errs() << "Examining load edge " << node << " -> " << tgtNode <<
             // "\n";
-            if (constraintGraph.insertCopyEdge(vRep, tgtNode)) {
+            if (insertCopyEdge(vRep, tgtNode)) {
               // errs() << "\tInsert copy edge " << v << " -> " << tgtNode <<
               // "\n";
-              nextWorkList->enqueue(vRep);
+              // The new edge is followed by its source in push mode, and by
+              // its target in pull mode
+              nextWorkList->enqueue(PullPropagation ? tgtNode : vRep);
             }
 
             // If we find that dst has been merged to elsewhere, remember this
@@ -561,11 +1211,11 @@ void Andersen::solveConstraints() {
           updateMap.clear();
 
           for (auto const &dst : cNode->stores()) {
-            NodeIndex tgtNode = nodeFactory.getMergeTarget(dst);
-            if (constraintGraph.insertCopyEdge(tgtNode, vRep)) {
+            NodeIndex tgtNode = solverFactory.getMergeTarget(dst);
+            if (insertCopyEdge(tgtNode, vRep)) {
               // errs() << "\tInsert copy edge " << tgtNode << " -> " << v <<
               // "\n";
-              nextWorkList->enqueue(tgtNode);
+              nextWorkList->enqueue(PullPropagation ? vRep : tgtNode);
             }
 
             // If we find that dst has been merged to elsewhere, remember this
@@ -582,26 +1232,30 @@ void Andersen::solveConstraints() {
         DenseMap<NodeIndex, NodeIndex> updateMap;
         // Finally, it's time to propagate pts-to info along the copy edges
         for (auto const &dst : *cNode) {
-          NodeIndex tgtNode = nodeFactory.getMergeTarget(dst);
+          NodeIndex tgtNode = solverFactory.getMergeTarget(dst);
           if (node == tgtNode)
             continue;
+          // In pull mode, the successors only have to know that there is
+          // something new to pull
+          if (PullPropagation) {
+            nextWorkList->enqueue(tgtNode);
+            if (tgtNode != dst)
+              updateMap[dst] = tgtNode;
+            continue;
+          }
           AndersPtsSet &tgtPtsSet = ptsGraph[tgtNode];
 
           // errs() << "pts[" << tgtNode << "] |= pts[" << node << "]\n";
-          bool isChanged = tgtPtsSet.unionWith(ptsSet);
+          bool isChanged = unionPtsSets(tgtPtsSet, ptsSet, solverFactory);
 
           if (isChanged) {
             nextWorkList->enqueue(tgtNode);
-          } else if (EnableLCD) {
-            // This is where we do lazy cycle detection.
-            // If this is a cycle candidate (equal points-to sets and this
-            // particular edge has not been cycle-checked previously), add to
-            // the list to check for cycles on the next iteration
-            auto edgePair = std::make_pair(node, tgtNode);
-            if (!checkedEdges.count(edgePair) && ptsSet == tgtPtsSet) {
-              checkedEdges.insert(edgePair);
-              cycleCandidates.insert(tgtNode);
-            }
+            if (useLCD)
+              lazyCycles.setChanged(tgtNode);
+          } else if (useLCD) {
+            // This is where we do lazy cycle detection. If this edge might be
+            // on a cycle, it is checked in one of the next iterations
+            lazyCycles.checkEdge(node, ptsSet, tgtNode, tgtPtsSet);
           }
 
           if (tgtNode != dst)
@@ -616,4 +1270,307 @@ void Andersen::solveConstraints() {
     // Swap the current and the next worklist
     std::swap(currWorkList, nextWorkList);
   }
+
+
+  if (use) {
+    auto hasContent = [&](NodeIndex obj) {
+      auto itr = ptsGraph.find(solverFactory.getMergeTarget(obj));
+      return itr != ptsGraph.end() && !itr->second.isEmpty();
+    };
+    use->writesUniversal = hasContent(solverFactory.getUniversalObjNode());
+    use->writesNull = hasContent(solverFactory.getNullObjectNode());
+    ConstraintGraphNode *nullNode = constraintGraph.getNodeWithIndex(
+        solverFactory.getMergeTarget(solverFactory.getNullObjectNode()));
+    use->readsNull = nullNode != nullptr &&
+                     (nullNode->begin() != nullNode->end() ||
+                      nullNode->load_begin() != nullNode->load_end() ||
+                      nullNode->store_begin() != nullNode->store_end());
+    use->mergesShared = countSharedNodes(solverFactory) != sharedBefore;
+  }
+}
+
+// One part of a partitioned solve
+struct ConstraintPart {
+  std::vector<AndersConstraint> constraints;
+  // The part is solved on nodes of its own
+  std::unique_ptr<AndersNodeCompactor> compactor;
+  std::map<NodeIndex, AndersPtsSet> ptsGraph;
+  SharedNodeUse use;
+};
+
+// Solve part on nodes of its own, renumbered from those in nodeFactory.
+// Neither nodeFactory nor offlineInfo is written to, so that several parts
+// can be solved at once, as long as nothing is merged in nodeFactory meanwhile
+void solvePart(ConstraintPart &part, AndersNodeFactory &nodeFactory,
+               const OfflineCycleDetector &offlineInfo) {
+  // A part only needs the objects its constraints mention. The others can't
+  // be in any of its points-to sets
+  part.compactor.reset(new AndersNodeCompactor(nodeFactory, false));
+  part.compactor->run(part.constraints);
+  DenseMap<NodeIndex, NodeIndex> collapseMap;
+  if (EnableHCD)
+    collapseMap = offlineInfo.getCompactCollapseMap(*part.compactor);
+  solveConstraintSet(part.constraints, part.compactor->getCompactFactory(),
+                     collapseMap, part.ptsGraph, &part.use);
+}
+
+// Solve constraints into ptsGraph, one weakly connected component at a time.
+// Nodes that no constraint connects can't exchange anything, so the
+// components can be solved apart, in parallel, each with data structures of
+// its own. Indirect calls need no special care here, since the constraints
+// already link every call site to every function it may call.
+// The special nodes, and the nodes merged with them, are left out of the
+// components, or most components would be connected through them. The parts
+// get their own copies of them instead. The universal and the null pointer
+// point to the same thing in every part, so copying them makes no difference.
+// The universal and the null object, on the other hand, are memory every part
+// may store into and load from. That only happens in some programs, and can't
+// be told before solving. So the parts are solved as if it didn't happen, and
+// the parts that turn out to have used the same object are solved again, all
+// together.
+void solvePartitioned(std::vector<AndersConstraint> &constraints,
+                      AndersNodeFactory &nodeFactory,
+                      const OfflineCycleDetector &offlineInfo,
+                      std::map<NodeIndex, AndersPtsSet> &ptsGraph) {
+  // The parts read the merge targets while they are solved. With every node
+  // pointing right at its representative, reading them never writes
+  nodeFactory.flattenMergeTargets();
+
+  SmallSet<NodeIndex, 4> sharedReps;
+  getSharedReps(nodeFactory, sharedReps);
+  auto isShared = [&](NodeIndex rep) { return sharedReps.count(rep) != 0; };
+
+  IntEqClasses components(nodeFactory.getNumNodes());
+  auto join = [&](NodeIndex n0, NodeIndex n1) {
+    NodeIndex rep0 = nodeFactory.getMergeTarget(n0);
+    NodeIndex rep1 = nodeFactory.getMergeTarget(n1);
+    if (!isShared(rep0) && !isShared(rep1))
+      components.join(rep0, rep1);
+  };
+  for (auto const &c : constraints)
+    join(c.getDest(), c.getSrc());
+  // HCD collapses what a pointer points to with its collapse target
+  for (auto const &mapping : offlineInfo.getCollapseMap())
+    join(mapping.first, mapping.second);
+  components.compress();
+
+  // Return the component of c, or InvalidIndex if it only refers to shared
+  // nodes. Those constraints go into every part
+  auto getComponent = [&](const AndersConstraint &c) {
+    NodeIndex dest = nodeFactory.getMergeTarget(c.getDest());
+    if (!isShared(dest))
+      return components[dest];
+    NodeIndex src = nodeFactory.getMergeTarget(c.getSrc());
+    if (!isShared(src))
+      return components[src];
+    return AndersNodeFactory::InvalidIndex;
+  };
+
+  // Put the components into parts, in order, the small ones together
+  std::vector<unsigned> componentSizes(components.getNumClasses(), 0);
+  for (auto const &c : constraints) {
+    unsigned component = getComponent(c);
+    if (component != AndersNodeFactory::InvalidIndex)
+      ++componentSizes[component];
+  }
+  std::vector<unsigned> componentParts(components.getNumClasses(),
+                                       AndersNodeFactory::InvalidIndex);
+  unsigned numParts = 0, lastPartSize = MinPartSize;
+  for (unsigned i = 0, e = componentSizes.size(); i < e; ++i) {
+    if (componentSizes[i] == 0)
+      continue;
+    if (lastPartSize >= MinPartSize) {
+      ++numParts;
+      lastPartSize = 0;
+    }
+    componentParts[i] = numParts - 1;
+    lastPartSize += componentSizes[i];
+  }
+  // There is a part even if every constraint is shared
+  numParts = std::max(numParts, 1u);
+
+  // Return the constraints of the parts isInPart accepts, and the constraints
+  // every part has
+  auto getPartConstraints = [&](std::function<bool(unsigned)> isInPart) {
+    std::vector<AndersConstraint> partConstraints;
+    for (auto const &c : constraints) {
+      unsigned component = getComponent(c);
+      if (component == AndersNodeFactory::InvalidIndex ||
+          isInPart(componentParts[component]))
+        partConstraints.push_back(c);
+    }
+    return partConstraints;
+  };
+
+  std::vector<ConstraintPart> parts(numParts);
+  for (auto const &c : constraints) {
+    unsigned component = getComponent(c);
+    if (component != AndersNodeFactory::InvalidIndex)
+      parts[componentParts[component]].constraints.push_back(c);
+  }
+  // The constraints every part has come last, so that each part is numbered
+  // starting from its own constraints
+  std::vector<AndersConstraint> sharedConstraints =
+      getPartConstraints([](unsigned) { return false; });
+  for (auto &part : parts)
+    part.constraints.insert(part.constraints.end(), sharedConstraints.begin(),
+                            sharedConstraints.end());
+
+  // Solve the parts, as many at a time as there are hardware threads
+  std::atomic<unsigned> nextPart(0);
+  auto solveParts = [&]() {
+    for (unsigned i = nextPart++; i < numParts; i = nextPart++)
+      solvePart(parts[i], nodeFactory, offlineInfo);
+  };
+  unsigned numThreads =
+      std::min(std::max(std::thread::hardware_concurrency(), 1u), numParts);
+  std::vector<std::future<void>> threads;
+  for (unsigned i = 1; i < numThreads; ++i)
+    threads.push_back(std::async(std::launch::async, solveParts));
+  solveParts();
+  for (auto &thread : threads)
+    thread.get();
+
+  // Anything stored into the universal object ends up in every object, so
+  // it connects every part. What is stored into the null object only reaches
+  // the parts that load from it. Nodes merged with the shared nodes would be
+  // merged in every part
+  bool isAllCoupled = false, isNullWritten = false;
+  for (auto const &part : parts) {
+    isAllCoupled |= part.use.writesUniversal || part.use.mergesShared;
+    isNullWritten |= part.use.writesNull;
+  }
+  std::vector<bool> isCoupled(numParts);
+  for (unsigned i = 0; i < numParts; ++i)
+    isCoupled[i] = isAllCoupled ||
+                   (isNullWritten &&
+                    (parts[i].use.writesNull || parts[i].use.readsNull));
+  unsigned numCoupled = std::count(isCoupled.begin(), isCoupled.end(), true);
+
+  // A part that is coupled to no other is done. The others are solved again
+  // as a single part. If that one turns out to store into the universal
+  // object as well, then everything is
+  ConstraintPart coupledPart;
+  if (numCoupled > 1) {
+    coupledPart.constraints =
+        getPartConstraints([&](unsigned i) { return isCoupled[i]; });
+    solvePart(coupledPart, nodeFactory, offlineInfo);
+    if (numCoupled < numParts &&
+        (coupledPart.use.writesUniversal || coupledPart.use.mergesShared)) {
+      isCoupled.assign(numParts, true);
+      coupledPart = ConstraintPart();
+      coupledPart.constraints = constraints;
+      solvePart(coupledPart, nodeFactory, offlineInfo);
+    }
+  } else
+    isCoupled.assign(numParts, false);
+  constraints.clear();
+
+  // Now carry the results over. The parts only share the special nodes, and
+  // the ones that are kept agree on them
+  auto addResult = [&](ConstraintPart &part) {
+    part.compactor->mapBack(part.ptsGraph);
+    for (auto &mapping : part.ptsGraph) {
+      auto itr = ptsGraph.find(mapping.first);
+      if (itr == ptsGraph.end())
+        ptsGraph.emplace(mapping.first, std::move(mapping.second));
+      else
+        unionPtsSets(itr->second, mapping.second, nodeFactory);
+    }
+    part.ptsGraph.clear();
+    part.compactor.reset();
+  };
+  for (unsigned i = 0; i < numParts; ++i)
+    if (!isCoupled[i])
+      addResult(parts[i]);
+  if (numCoupled > 1)
+    addResult(coupledPart);
+}
+
+// Solve constraints into ptsGraph by unification. The nodes whose objects
+// are in the same class have the same points-to set, so they are merged
+void solveByUnification(const std::vector<AndersConstraint> &constraints,
+                        AndersNodeFactory &nodeFactory,
+                        std::map<NodeIndex, AndersPtsSet> &ptsGraph) {
+  AndersUnifier unifier(nodeFactory);
+  unifier.run(constraints);
+
+  // Map from a class to the node that has its points-to set
+  DenseMap<unsigned, NodeIndex> classReps;
+  for (NodeIndex i = 0, e = nodeFactory.getNumNodes(); i < e; ++i) {
+    if (nodeFactory.getMergeTarget(i) != i)
+      continue;
+    unsigned pointee = unifier.getPointeeClass(i);
+    if (pointee == AndersNodeFactory::InvalidIndex)
+      continue;
+
+    auto itr = classReps.insert(std::make_pair(pointee, i));
+    if (!itr.second) {
+      nodeFactory.mergeNode(itr.first->second, i);
+      continue;
+    }
+    AndersPtsSet &ptsSet = ptsGraph[i];
+    for (NodeIndex obj : unifier.getPointees(i))
+      insertIntoPtsSet(ptsSet, nodeFactory.getObjectId(obj), nodeFactory);
+  }
+}
+
+} // end of anonymous namespace
+
+/// solveConstraints - This stage iteratively processes the constraints list
+/// propagating constraints (adding edges to the Nodes in the points-to graph)
+/// until a fixed point is reached.
+///
+/// We use a variant of the technique called "Lazy Cycle Detection", which is
+/// described in "The Ant and the Grasshopper: Fast and Accurate Pointer
+/// Analysis for Millions of Lines of Code. In Programming Language Design and
+/// Implementation (PLDI), June 2007."
+/// The paper describes performing cycle detection one node at a time, which can
+/// be expensive if there are no cycles, but there are long chains of nodes that
+/// it heuristically believes are cycles (because it will DFS from each node
+/// without state from previous nodes).
+/// Instead, we use the heuristic to build a worklist of nodes to check, then
+/// cycle detect them all at the same time to do this more cheaply.  This
+/// catches cycles slightly later than the original technique did, but does it
+/// make significantly cheaper. How often that happens adapts to how many nodes
+/// the checks collapse (see LazyCycleDetector).
+void Andersen::solveConstraints(OfflineConstraintGraph &offlineGraph) {
+  if (Steensgaard) {
+    solveByUnification(constraints, nodeFactory, ptsGraph);
+    return;
+  }
+
+  // We'll do offline HCD first. It reuses the offline constraint graph if the
+  // offline optimizations have built one
+  OfflineCycleDetector offlineInfo(offlineGraph, nodeFactory);
+  if (EnableHCD) {
+    if (!offlineGraph.isBuilt())
+      offlineGraph.build(constraints);
+    offlineInfo.run();
+  }
+
+  if (PartitionSolve) {
+    solvePartitioned(constraints, nodeFactory, offlineInfo, ptsGraph);
+    return;
+  }
+
+  // Then renumber the nodes if asked to. From here on, the solver works on
+  // the compact nodes, and leaves nodeFactory alone until it is done
+  AndersNodeCompactor compactor(nodeFactory);
+  DenseMap<NodeIndex, NodeIndex> compactCollapseMap;
+  if (CompactNodes) {
+    compactor.run(constraints);
+    if (EnableHCD)
+      compactCollapseMap = offlineInfo.getCompactCollapseMap(compactor);
+  }
+  AndersNodeFactory &solverFactory =
+      CompactNodes ? compactor.getCompactFactory() : nodeFactory;
+
+  solveConstraintSet(constraints, solverFactory,
+                     CompactNodes ? compactCollapseMap
+                                  : offlineInfo.getCollapseMap(),
+                     ptsGraph);
+
+  if (CompactNodes)
+    compactor.mapBack(ptsGraph);
 }
@@ -0,0 +1,175 @@
+#include "NodeCompactor.h"
+#include "CSRGraph.h"
+
+#include "llvm/ADT/BitVector.h"
+
+#include <algorithm>
+#include <queue>
+#include <utility>
+
+using namespace llvm;
+
+void AndersNodeCompactor::run(std::vector<AndersConstraint> &constraints) {
+  numberObjects(constraints);
+  unsigned numPinned = origNodes.size();
+
+  numberPointers(constraints);
+
+  // A node that got its compact node above for its index alone may have been
+  // merged into another one
+  for (NodeIndex i = 0; i < numPinned; ++i) {
+    NodeIndex rep = nodeFactory.getMergeTarget(origNodes[i]);
+    if (rep != origNodes[i])
+      compactFactory.mergeNode(getOrCreateCompactNode(rep), i);
+  }
+
+  std::vector<AndersConstraint> newConstraints;
+  newConstraints.reserve(constraints.size());
+  for (auto const &c : constraints) {
+    NodeIndex dest = getCompactNode(c.getDest());
+    // The address of a variable is NOT the same as the address of the
+    // variable it is merged into, so the source object is kept as it is
+    NodeIndex src = c.getType() == AndersConstraint::ADDR_OF
+                        ? compactNodes.find(c.getSrc())->second
+                        : getCompactNode(c.getSrc());
+    assert(dest != AndersNodeFactory::InvalidIndex &&
+           src != AndersNodeFactory::InvalidIndex);
+    newConstraints.emplace_back(c.getType(), dest, src);
+  }
+  constraints.swap(newConstraints);
+}
+
+void AndersNodeCompactor::numberObjects(
+    const std::vector<AndersConstraint> &constraints) {
+  // The special nodes keep their indices
+  for (NodeIndex i = 0, e = compactFactory.getNumNodes(); i < e; ++i) {
+    origNodes.push_back(i);
+    compactNodes[i] = i;
+  }
+
+  // The other object nodes come right after them in the same order
+  auto addObject = [this](NodeIndex orig) {
+    compactNodes[orig] = compactFactory.createObjectNode();
+    origNodes.push_back(orig);
+  };
+  if (allObjects) {
+    for (NodeIndex id = compactFactory.getNumObjects(),
+                   e = nodeFactory.getNumObjects();
+         id < e; ++id)
+      addObject(nodeFactory.getObjectNodeWithId(id));
+    return;
+  }
+
+  // Besides the objects whose addresses are taken, objects may be written
+  // directly (by global initializers, say), and have to stay objects then
+  std::vector<NodeIndex> objs;
+  auto addIfObject = [this, &objs](NodeIndex n) {
+    if (n >= compactFactory.getNumNodes() && nodeFactory.isObjectNode(n))
+      objs.push_back(n);
+  };
+  for (auto const &c : constraints) {
+    addIfObject(c.getType() == AndersConstraint::ADDR_OF
+                    ? c.getSrc()
+                    : nodeFactory.getMergeTarget(c.getSrc()));
+    addIfObject(nodeFactory.getMergeTarget(c.getDest()));
+  }
+  std::sort(objs.begin(), objs.end());
+  objs.erase(std::unique(objs.begin(), objs.end()), objs.end());
+  for (NodeIndex obj : objs)
+    addObject(obj);
+}
+
+void AndersNodeCompactor::numberPointers(
+    const std::vector<AndersConstraint> &constraints) {
+  // The edges along which the points-to sets flow between the
+  // representatives, whatever the kind of the constraint
+  CSRGraph graph;
+  CSRGraph::Builder builder(nodeFactory.getNumNodes());
+  auto addEdges = [&]() {
+    for (auto const &c : constraints)
+      if (c.getType() != AndersConstraint::ADDR_OF)
+        builder.addEdge(nodeFactory.getMergeTarget(c.getSrc()),
+                        nodeFactory.getMergeTarget(c.getDest()));
+  };
+  addEdges();
+  builder.startFilling();
+  addEdges();
+  builder.finish(graph);
+
+  BitVector visited(nodeFactory.getNumNodes());
+  std::queue<NodeIndex> queue;
+  auto visit = [&](NodeIndex n) {
+    if (visited.test(n))
+      return;
+    visited.set(n);
+    getOrCreateCompactNode(n);
+    queue.push(n);
+  };
+
+  for (auto const &c : constraints) {
+    visit(nodeFactory.getMergeTarget(c.getDest()));
+    if (c.getType() != AndersConstraint::ADDR_OF)
+      visit(nodeFactory.getMergeTarget(c.getSrc()));
+    while (!queue.empty()) {
+      NodeIndex node = queue.front();
+      queue.pop();
+      for (auto succ : *graph.getNode(node))
+        visit(succ);
+    }
+  }
+}
+
+NodeIndex AndersNodeCompactor::getCompactNode(NodeIndex orig) const {
+  auto itr = compactNodes.find(nodeFactory.getMergeTarget(orig));
+  if (itr == compactNodes.end())
+    return AndersNodeFactory::InvalidIndex;
+  return itr->second;
+}
+
+NodeIndex AndersNodeCompactor::getOrCreateCompactNode(NodeIndex orig) {
+  NodeIndex rep = nodeFactory.getMergeTarget(orig);
+  auto itr = compactNodes.insert(
+      std::make_pair(rep, AndersNodeFactory::InvalidIndex));
+  if (itr.second) {
+    // Every object node that is wanted has a compact node already
+    itr.first->second = compactFactory.createValueNode();
+    origNodes.push_back(rep);
+  }
+  return itr.first->second;
+}
+
+void AndersNodeCompactor::mapBack(std::map<NodeIndex, AndersPtsSet> &ptsGraph) {
+  for (NodeIndex i = 0, e = compactFactory.getNumNodes(); i < e; ++i) {
+    NodeIndex rep = compactFactory.getMergeTarget(i);
+    if (rep == i)
+      continue;
+    NodeIndex origRep = nodeFactory.getMergeTarget(origNodes[rep]);
+    NodeIndex orig = nodeFactory.getMergeTarget(origNodes[i]);
+    if (orig != origRep)
+      nodeFactory.mergeNode(origRep, orig);
+  }
+
+  // Points-to sets are over object ids. They are the same in both factories
+  // if every object has a compact node, and need translating otherwise
+  std::vector<NodeIndex> origIds;
+  if (!allObjects) {
+    for (NodeIndex id = 0, e = compactFactory.getNumObjects(); id < e; ++id)
+      origIds.push_back(nodeFactory.getObjectId(
+          origNodes[compactFactory.getObjectNodeWithId(id)]));
+  }
+  std::map<NodeIndex, AndersPtsSet> origPtsGraph;
+  for (auto &mapping : ptsGraph) {
+    NodeIndex origRep = nodeFactory.getMergeTarget(origNodes[mapping.first]);
+    if (!allObjects) {
+      AndersPtsSet origSet;
+      for (NodeIndex id : mapping.second)
+        origSet.insert(origIds[id]);
+      mapping.second = std::move(origSet);
+    }
+    bool isNew =
+        origPtsGraph.emplace(origRep, std::move(mapping.second)).second;
+    assert(isNew && "Two compact representatives for one node!");
+    (void)isNew;
+  }
+  ptsGraph.swap(origPtsGraph);
+}
@@ -6,6 +6,7 @@
 #include "llvm/Support/raw_ostream.h"
 
 #include <limits>
+#include <utility>
 
 using namespace llvm;
 
@@ -13,27 +14,41 @@ const unsigned AndersNodeFactory::InvalidIndex =
     std::numeric_limits<unsigned int>::max();
 
 AndersNodeFactory::AndersNodeFactory() {
-  // Note that we can't use std::vector::emplace_back() here because
-  // AndersNode's constructors are private hence std::vector cannot see it
-
   // Node #0 is always the universal ptr: the ptr that we don't know anything
   // about.
-  nodes.push_back(AndersNode(AndersNode::VALUE_NODE, 0));
+  pushNode(false, nullptr);
   // Node #0 is always the universal obj: the obj that we don't know anything
   // about.
-  nodes.push_back(AndersNode(AndersNode::OBJ_NODE, 1));
+  pushNode(true, nullptr);
   // Node #2 always represents the null pointer.
-  nodes.push_back(AndersNode(AndersNode::VALUE_NODE, 2));
+  pushNode(false, nullptr);
   // Node #3 is the object that null pointer points to
-  nodes.push_back(AndersNode(AndersNode::OBJ_NODE, 3));
+  pushNode(true, nullptr);
+
+  assert(getNumNodes() == 4);
+  assert(objNodes.size() == 2);
+  assert(objNodes[UniversalObjId] == UniversalObjIndex);
+}
+
+void AndersNodeFactory::reserve(unsigned numNodes) {
+  objNodeBits.reserve(numNodes);
+  mergeTargets.reserve(numNodes);
+  nodeValues.reserve(numNodes);
+}
 
-  assert(nodes.size() == 4);
+NodeIndex AndersNodeFactory::pushNode(bool isObj, const Value *val) {
+  unsigned nextIdx = getNumNodes();
+  objNodeBits.push_back(isObj);
+  mergeTargets.push_back(nextIdx);
+  nodeValues.push_back(val);
+  if (isObj)
+    objNodes.push_back(nextIdx);
+  return nextIdx;
 }
 
 NodeIndex AndersNodeFactory::createValueNode(const Value *val) {
   // errs() << "inserting " << *val << "\n";
-  unsigned nextIdx = nodes.size();
-  nodes.push_back(AndersNode(AndersNode::VALUE_NODE, nextIdx, val));
+  unsigned nextIdx = pushNode(false, val);
   if (val != nullptr) {
     assert(!valueNodeMap.count(val) &&
            "Trying to insert two mappings to revValueNodeMap!");
@@ -44,8 +59,7 @@ NodeIndex AndersNodeFactory::createValueNode(const Value *val) {
 }
 
 NodeIndex AndersNodeFactory::createObjectNode(const Value *val) {
-  unsigned nextIdx = nodes.size();
-  nodes.push_back(AndersNode(AndersNode::OBJ_NODE, nextIdx, val));
+  unsigned nextIdx = pushNode(true, val);
   if (val != nullptr) {
     assert(!objNodeMap.count(val) &&
            "Trying to insert two mappings to revObjNodeMap!");
@@ -56,8 +70,7 @@ NodeIndex AndersNodeFactory::createObjectNode(const Value *val) {
 }
 
 NodeIndex AndersNodeFactory::createReturnNode(const llvm::Function *f) {
-  unsigned nextIdx = nodes.size();
-  nodes.push_back(AndersNode(AndersNode::VALUE_NODE, nextIdx, f));
+  unsigned nextIdx = pushNode(false, f);
 
   assert(!returnMap.count(f) && "Trying to insert two mappings to returnMap!");
   returnMap[f] = nextIdx;
@@ -66,8 +79,7 @@ NodeIndex AndersNodeFactory::createReturnNode(const llvm::Function *f) {
 }
 
 NodeIndex AndersNodeFactory::createVarargNode(const llvm::Function *f) {
-  unsigned nextIdx = nodes.size();
-  nodes.push_back(AndersNode(AndersNode::OBJ_NODE, nextIdx, f));
+  unsigned nextIdx = pushNode(true, f);
 
   assert(!varargMap.count(f) && "Trying to insert two mappings to varargMap!");
   varargMap[f] = nextIdx;
@@ -174,33 +186,170 @@ NodeIndex AndersNodeFactory::getVarargNodeFor(const llvm::Function *f) const {
     return itr->second;
 }
 
-void AndersNodeFactory::mergeNode(NodeIndex n0, NodeIndex n1) {
-  assert(n0 < nodes.size() && n1 < nodes.size());
-  nodes[n1].mergeTarget = n0;
+NodeIndex AndersNodeFactory::compressPath(NodeIndex n) {
+  NodeIndex ret = n;
+  while (ret != mergeTargets[ret])
+    ret = mergeTargets[ret];
+  while (n != ret) {
+    NodeIndex next = mergeTargets[n];
+    mergeTargets[n] = ret;
+    n = next;
+  }
+  return ret;
+}
+
+void AndersNodeFactory::flattenMergeTargets() {
+  // Nodes are visited in index order, so a node's merge target may not be
+  // flattened yet. Following it to the root is still correct
+  for (auto &target : mergeTargets) {
+    NodeIndex ret = target;
+    while (ret != mergeTargets[ret])
+      ret = mergeTargets[ret];
+    target = ret;
+  }
+}
+
+void AndersNodeFactory::mergeLocation(NodeIndex n0, NodeIndex n1) {
+  assert(n0 < getNumNodes() && n1 < getNumNodes());
+  assert(isObjectNode(n0) && isObjectNode(n1));
+  assert(n0 != n1);
+
+  // n1 might already stand for other objects. Move them out first since
+  // inserting n0 may invalidate the reference into the map
+  std::vector<NodeIndex> n1Equivs;
+  auto itr = locEquivMap.find(n1);
+  if (itr != locEquivMap.end()) {
+    n1Equivs = std::move(itr->second);
+    locEquivMap.erase(itr);
+  }
+
+  auto &n0Equivs = locEquivMap[n0];
+  n0Equivs.push_back(n1);
+  n0Equivs.insert(n0Equivs.end(), n1Equivs.begin(), n1Equivs.end());
 }
 
-NodeIndex AndersNodeFactory::getMergeTarget(NodeIndex n) {
-  assert(n < nodes.size());
-  NodeIndex ret = nodes[n].mergeTarget;
-  if (ret != n) {
-    std::vector<NodeIndex> path(1, n);
-    while (ret != nodes[ret].mergeTarget) {
-      path.push_back(ret);
-      ret = nodes[ret].mergeTarget;
+// Move the entry of oldKey in map over to newKey, unless newKey is null or has
+// an entry already. Return the node of the entry (or InvalidIndex if oldKey
+// has none), and whether newKey now maps to it
+template <typename MapType, typename KeyType>
+static std::pair<NodeIndex, bool> moveMapEntry(MapType &map, KeyType oldKey,
+                                               KeyType newKey) {
+  auto itr = map.find(oldKey);
+  if (itr == map.end())
+    return std::make_pair(AndersNodeFactory::InvalidIndex, false);
+
+  NodeIndex idx = itr->second;
+  map.erase(itr);
+  bool moved =
+      newKey != nullptr && map.insert(std::make_pair(newKey, idx)).second;
+  return std::make_pair(idx, moved);
+}
+
+void AndersNodeFactory::releaseNode(NodeIndex idx, const Value *oldVal,
+                                    const Value *newVal) {
+  if (idx == InvalidIndex)
+    return;
+  if (nodeValues[idx] != oldVal) {
+    // oldVal was a copy of the object. Now newVal is
+    if (newVal != nullptr && isObjectNode(idx))
+      objCopyMap[idx].push_back(newVal);
+    return;
+  }
+
+  if (newVal == nullptr) {
+    // Copies that have been removed or replaced since are skipped
+    auto itr = objCopyMap.find(idx);
+    if (itr != objCopyMap.end()) {
+      auto &copies = itr->second;
+      while (!copies.empty() && newVal == nullptr) {
+        auto objItr = objNodeMap.find(copies.back());
+        if (objItr != objNodeMap.end() && objItr->second == idx)
+          newVal = copies.back();
+        copies.pop_back();
+      }
+      if (copies.empty())
+        objCopyMap.erase(itr);
     }
-    for (auto idx : path)
-      nodes[idx].mergeTarget = ret;
   }
-  assert(ret < nodes.size());
-  return ret;
+  nodeValues[idx] = newVal;
 }
 
-NodeIndex AndersNodeFactory::getMergeTarget(NodeIndex n) const {
-  assert(n < nodes.size());
-  NodeIndex ret = nodes[n].mergeTarget;
-  while (ret != nodes[ret].mergeTarget)
-    ret = nodes[ret].mergeTarget;
-  return ret;
+void AndersNodeFactory::replaceValue(const Value *oldVal,
+                                     const Value *newVal) {
+  // Constants other than globals are looked up without the maps
+  if (newVal != nullptr && isa<Constant>(newVal) && !isa<GlobalValue>(newVal))
+    newVal = nullptr;
+
+  auto valEntry = moveMapEntry(valueNodeMap, oldVal, newVal);
+  releaseNode(valEntry.first, oldVal, valEntry.second ? newVal : nullptr);
+  auto objEntry = moveMapEntry(objNodeMap, oldVal, newVal);
+  releaseNode(objEntry.first, oldVal, objEntry.second ? newVal : nullptr);
+
+  if (const Function *oldF = dyn_cast<Function>(oldVal)) {
+    const Function *newF = dyn_cast_or_null<Function>(newVal);
+    auto retEntry = moveMapEntry(returnMap, oldF, newF);
+    releaseNode(retEntry.first, oldF, retEntry.second ? newF : nullptr);
+    auto vaEntry = moveMapEntry(varargMap, oldF, newF);
+    releaseNode(vaEntry.first, oldF, vaEntry.second ? newF : nullptr);
+  }
+}
+
+void AndersNodeFactory::removeValue(const Value *val) {
+  replaceValue(val, nullptr);
+}
+
+void AndersNodeFactory::copyValue(const Value *from, const Value *to) {
+  if (isa<Constant>(to) && !isa<GlobalValue>(to))
+    return;
+
+  // Note that createValueNode() and the inserts below may invalidate any
+  // iterator into the maps
+  NodeIndex valNode = getValueNodeFor(from);
+  if (valNode != InvalidIndex && !valueNodeMap.count(to)) {
+    NodeIndex rep = getMergeTarget(valNode);
+    mergeNode(rep, createValueNode(to));
+    copiedReps.insert(rep);
+  }
+
+  NodeIndex objNode = getObjectNodeFor(from);
+  if (objNode != InvalidIndex && !objNodeMap.count(to)) {
+    objNodeMap[to] = objNode;
+    objCopyMap[objNode].push_back(to);
+  }
+
+  const Function *fromF = dyn_cast<Function>(from);
+  const Function *toF = dyn_cast<Function>(to);
+  if (fromF == nullptr || toF == nullptr)
+    return;
+  NodeIndex retNode = getReturnNodeFor(fromF);
+  if (retNode != InvalidIndex && !returnMap.count(toF)) {
+    NodeIndex rep = getMergeTarget(retNode);
+    mergeNode(rep, createReturnNode(toF));
+  }
+  NodeIndex vaNode = getVarargNodeFor(fromF);
+  if (vaNode != InvalidIndex && !varargMap.count(toF))
+    varargMap[toF] = vaNode;
+}
+
+bool AndersNodeFactory::hasNodesFor(const Value *val) const {
+  if (valueNodeMap.count(val) || objNodeMap.count(val))
+    return true;
+  if (const Function *f = dyn_cast<Function>(val))
+    return returnMap.count(f) || varargMap.count(f);
+  return false;
+}
+
+void AndersNodeFactory::getMappedValues(
+    std::vector<const llvm::Value *> &vals) const {
+  vals.clear();
+  for (auto const &mapping : valueNodeMap)
+    vals.push_back(mapping.first);
+  for (auto const &mapping : objNodeMap)
+    vals.push_back(mapping.first);
+  for (auto const &mapping : returnMap)
+    vals.push_back(mapping.first);
+  for (auto const &mapping : varargMap)
+    vals.push_back(mapping.first);
 }
 
 void AndersNodeFactory::getAllocSites(
@@ -212,22 +361,19 @@ void AndersNodeFactory::getAllocSites(
 }
 
 void AndersNodeFactory::dumpNode(NodeIndex idx) const {
-  const AndersNode &n = nodes.at(idx);
-  if (n.type == AndersNode::VALUE_NODE)
-    errs() << "[V ";
-  else if (n.type == AndersNode::OBJ_NODE)
+  if (isObjectNode(idx))
     errs() << "[O ";
   else
-    assert(false && "Wrong type number!");
-  errs() << "#" << n.idx << "]";
+    errs() << "[V ";
+  errs() << "#" << idx << "]";
 }
 
 void AndersNodeFactory::dumpNodeInfo() const {
   errs() << "\n----- Print AndersNodeFactory Info -----\n";
-  for (auto const &node : nodes) {
-    dumpNode(node.getIndex());
+  for (NodeIndex i = 0, e = getNumNodes(); i < e; ++i) {
+    dumpNode(i);
     errs() << ", val = ";
-    const Value *val = node.getValue();
+    const Value *val = getValueForNode(i);
     if (val == nullptr)
       errs() << "nullptr";
     else if (isa<Function>(val))
@@ -250,7 +396,7 @@ void AndersNodeFactory::dumpNodeInfo() const {
 
 void AndersNodeFactory::dumpRepInfo() const {
   errs() << "\n----- Print Node Merge Info -----\n";
-  for (NodeIndex i = 0, e = nodes.size(); i < e; ++i) {
+  for (NodeIndex i = 0, e = getNumNodes(); i < e; ++i) {
     NodeIndex rep = getMergeTarget(i);
     if (rep != i)
       errs() << i << " -> " << rep << "\n";
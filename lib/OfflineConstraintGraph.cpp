@@ -0,0 +1,241 @@
+#include "OfflineConstraintGraph.h"
+
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <deque>
+
+using namespace llvm;
+
+void OfflineConstraintGraph::addEdge(CSRGraph::Builder &builder,
+                                     NodeIndex node, NodeIndex pred,
+                                     bool isExtra) {
+  node = getMergeTarget(node);
+  pred = getMergeTarget(pred);
+  // A pointer that points to nothing has nothing to give or take through *p
+  if (node == pred || isEmptyRefNode(node) || isEmptyRefNode(pred))
+    return;
+  builder.addEdge(node, pred, isExtra);
+}
+
+void OfflineConstraintGraph::addConstraintEdges(
+    CSRGraph::Builder &builder,
+    const std::vector<AndersConstraint> &constraints) {
+  for (auto const &c : constraints) {
+    NodeIndex srcTgt = nodeFactory.getMergeTarget(c.getSrc());
+    NodeIndex dstTgt = nodeFactory.getMergeTarget(c.getDest());
+    switch (c.getType()) {
+    case AndersConstraint::ADDR_OF: {
+      addrTakenNodes.set(srcTgt);
+      // Dest = &src edge. The address of a variable is NOT the same as the
+      // address of the variable it is merged into, so don't use srcTgt here
+      addEdge(builder, dstTgt, getAdrNodeIndex(c.getSrc()), true);
+      // *Dest = src edge
+      addEdge(builder, getRefNodeIndex(dstTgt), srcTgt, true);
+      break;
+    }
+    case AndersConstraint::LOAD: {
+      // dest = *src edge
+      addEdge(builder, dstTgt, getRefNodeIndex(srcTgt), false);
+      break;
+    }
+    case AndersConstraint::STORE: {
+      // *dest = src edge
+      addEdge(builder, getRefNodeIndex(dstTgt), srcTgt, false);
+      break;
+    }
+    case AndersConstraint::COPY: {
+      // Dest = Src edge
+      addEdge(builder, dstTgt, srcTgt, false);
+      // *Dest = *Src edge
+      addEdge(builder, getRefNodeIndex(dstTgt), getRefNodeIndex(srcTgt), true);
+      break;
+    }
+    }
+  }
+}
+
+void OfflineConstraintGraph::addGraphEdges(CSRGraph::Builder &builder) {
+  for (auto itr = graph.node_begin(), ite = graph.node_end(); itr != ite;
+       ++itr) {
+    NodeIndex n = itr->getNodeIndex();
+    NodeIndex tgt = getMergeTarget(n);
+    for (auto pItr = itr->begin(), pIte = itr->end(); pItr != pIte; ++pItr) {
+      bool isExtra = pItr >= itr->primary_end();
+      addEdge(builder, tgt, *pItr, isExtra);
+      if (isExtra)
+        continue;
+
+      // A store *ptr = v or a load d = *ptr through a pointer whose only
+      // pointee is obj is now the copy obj = v or d = obj. Add the implicit
+      // *Dest = *Src edge of the copy, as if the graph were built from the
+      // rewritten constraint
+      NodeIndex predTgt = getMergeTarget(*pItr);
+      if ((isRefNode(n) && isVarNode(tgt)) ||
+          (isRefNode(*pItr) && isVarNode(predTgt)))
+        addEdge(builder, getRefNodeIndex(tgt), getRefNodeIndex(predTgt), true);
+    }
+  }
+}
+
+void OfflineConstraintGraph::build(
+    const std::vector<AndersConstraint> &constraints) {
+  releaseMemory();
+
+  numNodes = nodeFactory.getNumNodes();
+  addrTakenNodes.resize(numNodes);
+  foldedNodes.resize(numNodes);
+  noPointee.resize(numNodes);
+
+  CSRGraph::Builder builder(getSize());
+  addConstraintEdges(builder, constraints);
+  builder.startFilling();
+  addConstraintEdges(builder, constraints);
+  builder.finish(graph);
+
+  // Nodes merged before the graph is built have no edges of their own
+  for (NodeIndex i = 0; i < numNodes; ++i) {
+    if (nodeFactory.getMergeTarget(i) != i)
+      foldedNodes.set(i);
+  }
+
+  built = true;
+}
+
+NodeIndex OfflineConstraintGraph::getMergeTarget(NodeIndex n) {
+  if (isVarNode(n))
+    return nodeFactory.getMergeTarget(n);
+  if (isRefNode(n)) {
+    NodeIndex ptr = nodeFactory.getMergeTarget(n - numNodes);
+    auto itr = uniquePointee.find(ptr);
+    if (itr != uniquePointee.end())
+      return nodeFactory.getMergeTarget(itr->second);
+    return getRefNodeIndex(ptr);
+  }
+  return n;
+}
+
+void OfflineConstraintGraph::updateMerges() {
+  assert(built && "Updating a graph that has not been built!");
+
+  bool changed = stale;
+  for (NodeIndex i = 0; i < numNodes; ++i) {
+    if (foldedNodes.test(i))
+      continue;
+    NodeIndex rep = nodeFactory.getMergeTarget(i);
+    if (rep == i)
+      continue;
+
+    // Once i and rep are the same pointer, whatever we know about i holds for
+    // rep as well
+    if (addrTakenNodes.test(i))
+      addrTakenNodes.set(rep);
+    auto ptItr = uniquePointee.find(i);
+    if (ptItr != uniquePointee.end())
+      uniquePointee.insert(std::make_pair(rep, ptItr->second));
+    if (noPointee.test(i))
+      noPointee.set(rep);
+
+    foldedNodes.set(i);
+    changed = true;
+  }
+  if (!changed)
+    return;
+
+  // The new graph is built from the current one, so it can't be built in place
+  CSRGraph newGraph;
+  CSRGraph::Builder builder(getSize());
+  addGraphEdges(builder);
+  builder.startFilling();
+  addGraphEdges(builder);
+  builder.finish(newGraph);
+  graph = std::move(newGraph);
+  stale = false;
+}
+
+void OfflineConstraintGraph::setUniquePointee(NodeIndex ptr, NodeIndex obj) {
+  assert(nodeFactory.getMergeTarget(ptr) == ptr &&
+         "Only representatives may have unique pointees!");
+  // This is valid for every pass, HCD included: whatever *ptr means, it can
+  // only mean obj
+  if (uniquePointee.insert(std::make_pair(ptr, obj)).second)
+    stale = true;
+}
+
+void OfflineConstraintGraph::setNoPointee(NodeIndex ptr) {
+  assert(nodeFactory.getMergeTarget(ptr) == ptr &&
+         "Only representatives may be marked!");
+  if (!noPointee.test(ptr)) {
+    noPointee.set(ptr);
+    stale = true;
+  }
+}
+
+void OfflineConstraintGraph::releaseMemory() {
+  graph.releaseMemory();
+  addrTakenNodes.clear();
+  foldedNodes.clear();
+  uniquePointee.clear();
+  noPointee.clear();
+  numNodes = 0;
+  built = false;
+  stale = false;
+}
+
+void OfflineConstraintGraph::printNode(raw_ostream &os, NodeIndex n) const {
+  if (isAdrNode(n))
+    os << "<ADR> ";
+  else if (isRefNode(n))
+    os << "<REF> ";
+  os << "[Node " << n % numNodes << "]";
+}
+
+void OfflineConstraintGraph::dump() const {
+  errs() << "\n----- Offline Constraint Graph -----\n";
+  for (auto itr = node_begin(), ite = node_end(); itr != ite; ++itr) {
+    printNode(errs(), itr->getNodeIndex());
+    errs() << "  -->  ";
+    for (auto pItr = itr->begin(), pIte = itr->end(); pItr != pIte;
+         ++pItr) {
+      printNode(errs(), *pItr);
+      errs() << ", ";
+    }
+    errs() << '\n';
+  }
+  errs() << "----- End of Print -----\n";
+}
+
+void OfflineConstraintGraph::writeToDotFile(const char *fileName) const {
+  std::error_code errInfo;
+  ToolOutputFile outFile(fileName, errInfo, sys::fs::F_Text);
+  if (errInfo) {
+    errs() << errInfo.message() << '\n';
+    return;
+  }
+
+  raw_fd_ostream &os = outFile.os();
+  os << "digraph G {\n";
+  std::deque<bool> hasLabel(getSize(), false);
+  auto writeLabel = [&](NodeIndex n) {
+    if (hasLabel[n])
+      return;
+    os << "\tnode" << n << " [label = \"";
+    printNode(os, n);
+    os << "\"]\n";
+    hasLabel[n] = true;
+  };
+  for (auto itr = node_begin(), ite = node_end(); itr != ite; ++itr) {
+    NodeIndex n = itr->getNodeIndex();
+    writeLabel(n);
+    for (auto pItr = itr->begin(), pIte = itr->end(); pItr != pIte;
+         ++pItr) {
+      writeLabel(*pItr);
+      os << "\tnode" << *pItr << " -> "
+         << "node" << n << '\n';
+    }
+  }
+  os << "}\n";
+
+  outFile.keep();
+}
@@ -0,0 +1,172 @@
+#include "Unification.h"
+
+#include "llvm/ADT/BitVector.h"
+
+#include <algorithm>
+
+using namespace llvm;
+
+unsigned AndersUnifier::find(unsigned elem) {
+  // Path halving
+  while (parents[elem] != elem) {
+    parents[elem] = parents[parents[elem]];
+    elem = parents[elem];
+  }
+  return elem;
+}
+
+unsigned AndersUnifier::getPointee(unsigned elem) {
+  elem = find(elem);
+  if (pointees[elem] == AndersNodeFactory::InvalidIndex) {
+    unsigned newClass = parents.size();
+    parents.push_back(newClass);
+    ranks.push_back(0);
+    pointees.push_back(AndersNodeFactory::InvalidIndex);
+    pointees[elem] = newClass;
+  }
+  return find(pointees[elem]);
+}
+
+void AndersUnifier::unify(unsigned elem0, unsigned elem1) {
+  // Joining two classes joins what they point to as well. That is done with
+  // a worklist, since the chains of pointees may be long
+  pendingUnions.emplace_back(elem0, elem1);
+  while (!pendingUnions.empty()) {
+    unsigned c0 = find(pendingUnions.back().first);
+    unsigned c1 = find(pendingUnions.back().second);
+    pendingUnions.pop_back();
+    if (c0 == c1)
+      continue;
+
+    if (ranks[c0] < ranks[c1])
+      std::swap(c0, c1);
+    else if (ranks[c0] == ranks[c1])
+      ++ranks[c0];
+    parents[c1] = c0;
+
+    unsigned p0 = pointees[c0], p1 = pointees[c1];
+    if (p0 == AndersNodeFactory::InvalidIndex)
+      pointees[c0] = p1;
+    else if (p1 != AndersNodeFactory::InvalidIndex)
+      pendingUnions.emplace_back(p0, p1);
+
+    // The load targets of c1 go over to c0, unless c0 has the universal
+    // object now. Then they, and the ones of c0, get it
+    std::vector<unsigned> targets;
+    auto itr = loadTargets.find(c1);
+    if (itr != loadTargets.end()) {
+      targets = std::move(itr->second);
+      loadTargets.erase(itr);
+    }
+    if (find(nodeFactory.getUniversalObjNode()) == c0) {
+      itr = loadTargets.find(c0);
+      if (itr != loadTargets.end()) {
+        targets.insert(targets.end(), itr->second.begin(), itr->second.end());
+        loadTargets.erase(itr);
+      }
+      for (unsigned target : targets)
+        pendingUnions.emplace_back(target, nodeFactory.getUniversalObjNode());
+    } else if (!targets.empty()) {
+      std::vector<unsigned> &c0Targets = loadTargets[c0];
+      if (c0Targets.size() < targets.size())
+        c0Targets.swap(targets);
+      c0Targets.insert(c0Targets.end(), targets.begin(), targets.end());
+    }
+  }
+}
+
+void AndersUnifier::addLoadTarget(unsigned ptrElem, unsigned targetElem) {
+  unsigned ptrClass = find(ptrElem);
+  if (ptrClass == find(nodeFactory.getUniversalObjNode()))
+    unify(targetElem, nodeFactory.getUniversalObjNode());
+  else
+    loadTargets[ptrClass].push_back(targetElem);
+}
+
+void AndersUnifier::run(const std::vector<AndersConstraint> &constraints) {
+  unsigned numNodes = nodeFactory.getNumNodes();
+  parents.resize(numNodes);
+  for (unsigned i = 0; i < numNodes; ++i)
+    parents[i] = i;
+  ranks.assign(numNodes, 0);
+  pointees.assign(numNodes, AndersNodeFactory::InvalidIndex);
+
+  // The contents of an object are the points-to set of its node's merge
+  // target. The other nodes are only used through their merge targets
+  for (NodeIndex obj : nodeFactory.getObjectNodes()) {
+    NodeIndex objTgt = nodeFactory.getMergeTarget(obj);
+    if (objTgt != obj)
+      unify(getPointee(obj), getPointee(objTgt));
+  }
+
+  BitVector addrTaken(numNodes);
+  for (auto const &c : constraints) {
+    NodeIndex destTgt = nodeFactory.getMergeTarget(c.getDest());
+    switch (c.getType()) {
+    case AndersConstraint::ADDR_OF: {
+      // The address of a variable is NOT the same as the address of the
+      // variable it is merged into, so the object is taken as it is
+      addrTaken.set(c.getSrc());
+      unify(getPointee(destTgt), c.getSrc());
+      break;
+    }
+    case AndersConstraint::COPY: {
+      NodeIndex srcTgt = nodeFactory.getMergeTarget(c.getSrc());
+      unify(getPointee(destTgt), getPointee(srcTgt));
+      break;
+    }
+    case AndersConstraint::LOAD: {
+      NodeIndex srcTgt = nodeFactory.getMergeTarget(c.getSrc());
+      unsigned ptrClass = getPointee(srcTgt);
+      unify(getPointee(destTgt), getPointee(ptrClass));
+      addLoadTarget(ptrClass, getPointee(destTgt));
+      break;
+    }
+    case AndersConstraint::STORE: {
+      NodeIndex srcTgt = nodeFactory.getMergeTarget(c.getSrc());
+      unify(getPointee(getPointee(destTgt)), getPointee(srcTgt));
+      break;
+    }
+    }
+  }
+
+  // Every object holds what the universal object holds (see
+  // buildConstraintGraph()). Only do that if it holds anything, or the
+  // contents of all the objects would end up in one class for nothing
+  unsigned univContents = pointees[find(nodeFactory.getUniversalObjNode())];
+  if (univContents != AndersNodeFactory::InvalidIndex) {
+    unsigned univContentsClass = find(univContents);
+    bool hasObjects = false;
+    for (int i = addrTaken.find_first(); i != -1 && !hasObjects;
+         i = addrTaken.find_next(i))
+      hasObjects = find(i) == univContentsClass;
+    if (hasObjects)
+      for (NodeIndex obj : nodeFactory.getObjectNodes())
+        unify(getPointee(obj), univContentsClass);
+  }
+
+  // Point every element right at its leader, so that the queries don't have
+  // to change the forest
+  for (unsigned i = 0, e = parents.size(); i < e; ++i)
+    parents[i] = find(i);
+  for (int i = addrTaken.find_first(); i != -1; i = addrTaken.find_next(i))
+    classObjects[parents[i]].push_back(i);
+}
+
+unsigned AndersUnifier::getPointeeClass(NodeIndex n) const {
+  unsigned pointee = pointees[parents[nodeFactory.getMergeTarget(n)]];
+  if (pointee == AndersNodeFactory::InvalidIndex)
+    return AndersNodeFactory::InvalidIndex;
+  pointee = parents[pointee];
+  // A class without objects is as good as no class at all
+  if (!classObjects.count(pointee))
+    return AndersNodeFactory::InvalidIndex;
+  return pointee;
+}
+
+ArrayRef<NodeIndex> AndersUnifier::getPointees(NodeIndex n) const {
+  unsigned pointee = getPointeeClass(n);
+  if (pointee == AndersNodeFactory::InvalidIndex)
+    return None;
+  return classObjects.find(pointee)->second;
+}
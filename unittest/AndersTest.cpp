@@ -1,21 +1,33 @@
+#include "Andersen.h"
+#include "AndersenAA.h"
+#include "CSRGraph.h"
+#include "HashedSparseBitVector.h"
+#include "NodeCompactor.h"
 #include "NodeFactory.h"
+#include "OfflineConstraintGraph.h"
 #include "PtsSet.h"
-#include "SparseBitVectorGraph.h"
+#include "PtsSetStore.h"
+#include "Unification.h"
 
 #include "llvm/Analysis/CFG.h"
+#include "llvm/Analysis/TargetLibraryInfo.h"
 #include "llvm/AsmParser/Parser.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/PassManager.h"
 #include "llvm/Pass.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/ErrorHandling.h"
 #include "llvm/Support/SourceMgr.h"
 #include "llvm/Support/raw_ostream.h"
 #include "gtest/gtest.h"
 
+#include <algorithm>
 #include <memory>
+#include <thread>
 
 using namespace llvm;
 
@@ -44,55 +56,175 @@ TEST(AndersTest, PtsSetTest) {
     EXPECT_EQ(pSet1.getSize(), 3u);
 }
 
-TEST(AndersTest, SparseBitVectorGraphTest) {
-    SparseBitVectorGraph graph;
-
-    auto node1 = graph.getOrInsertNode(1);
-    auto node2 = graph.getOrInsertNode(2);
-    auto node3 = graph.getOrInsertNode(3);
-    auto node4 = graph.getOrInsertNode(4);
-    auto node5 = graph.getOrInsertNode(5);
-    auto node6 = graph.getOrInsertNode(6);
-
-    EXPECT_EQ(graph.getSize(), 6u);
-    EXPECT_TRUE(graph.getNodeWithIndex(0) == nullptr);
-    ASSERT_TRUE(graph.getNodeWithIndex(1) != nullptr);
-    ASSERT_TRUE(graph.getNodeWithIndex(2) != nullptr);
-    ASSERT_TRUE(graph.getNodeWithIndex(3) != nullptr);
-    ASSERT_TRUE(graph.getNodeWithIndex(4) != nullptr);
-    ASSERT_TRUE(graph.getNodeWithIndex(5) != nullptr);
-    ASSERT_TRUE(graph.getNodeWithIndex(6) != nullptr);
-    EXPECT_TRUE(graph.getNodeWithIndex(7) == nullptr);
-    EXPECT_EQ(node1->getNodeIndex(), 1u);
-    EXPECT_EQ(node2->getNodeIndex(), 2u);
-    EXPECT_EQ(node3->getNodeIndex(), 3u);
-    EXPECT_EQ(node4->getNodeIndex(), 4u);
-    EXPECT_EQ(node5->getNodeIndex(), 5u);
-    EXPECT_EQ(node6->getNodeIndex(), 6u);
-
-    //        |-> 3 \
-	// 1 -> 2 |      -> 5 -> 6
-    //        |-> 4 /
-    graph.insertEdge(1, 2);
-    graph.insertEdge(2, 3);
-    graph.insertEdge(2, 4);
-    graph.insertEdge(3, 5);
-    graph.insertEdge(4, 5);
-    graph.insertEdge(5, 6);
-
-    EXPECT_EQ(node1->succ_getSize(), 1u);
-    EXPECT_EQ(node2->succ_getSize(), 2u);
-    EXPECT_EQ(node3->succ_getSize(), 1u);
-    EXPECT_EQ(node4->succ_getSize(), 1u);
-    EXPECT_EQ(node5->succ_getSize(), 1u);
-    EXPECT_EQ(node6->succ_getSize(), 0u);
-
-    graph.mergeEdge(4, 5);
-    EXPECT_EQ(node4->succ_getSize(), 2u);
-    graph.mergeEdge(5, 6);
-    EXPECT_EQ(node5->succ_getSize(), 1u);
-    graph.mergeEdge(3, 2);
-    EXPECT_EQ(node3->succ_getSize(), 3u);
+TEST(AndersTest, HashedSparseBitVectorTest) {
+    HashedSparseBitVector vec1, vec2, vec3;
+    EXPECT_TRUE(vec1.empty());
+    EXPECT_EQ(vec1.getHash(), vec2.getHash());
+
+    // {1, 2, 3} and {0}
+    EXPECT_TRUE(vec1.insert(1));
+    EXPECT_TRUE(vec1.insert(2));
+    EXPECT_TRUE(vec1.insert(3));
+    EXPECT_FALSE(vec1.insert(2));
+    EXPECT_TRUE(vec2.insert(0));
+    EXPECT_NE(vec1.getHash(), vec2.getHash());
+    EXPECT_NE(vec2.getHash(), vec3.getHash());
+
+    // The hash doesn't depend on how the set is built
+    EXPECT_TRUE(vec3.insert(3));
+    HashedSparseBitVector vec4;
+    EXPECT_TRUE(vec4.insert(1));
+    EXPECT_TRUE(vec4.insert(2));
+    EXPECT_TRUE(vec3.unionWith(vec4));
+    EXPECT_FALSE(vec3.unionWith(vec4));
+    EXPECT_EQ(vec1.getHash(), vec3.getHash());
+    EXPECT_TRUE(vec1 == vec3);
+
+    EXPECT_TRUE(vec2.unionWith(vec1));
+    EXPECT_NE(vec1.getHash(), vec2.getHash());
+    EXPECT_TRUE(vec1 != vec2);
+}
+
+TEST(AndersTest, OfflineConstraintGraphTest) {
+    AndersNodeFactory factory;
+
+    auto p = factory.createValueNode();
+    auto q = factory.createValueNode();
+    auto r = factory.createValueNode();
+    auto o = factory.createObjectNode();
+
+    // p = &o, q = p, r = *q
+    std::vector<AndersConstraint> constraints;
+    constraints.emplace_back(AndersConstraint::ADDR_OF, p, o);
+    constraints.emplace_back(AndersConstraint::COPY, q, p);
+    constraints.emplace_back(AndersConstraint::LOAD, r, q);
+
+    OfflineConstraintGraph graph(factory);
+    graph.build(constraints);
+    ASSERT_TRUE(graph.isBuilt());
+    EXPECT_TRUE(graph.getAddrTakenNodes().test(o));
+
+    auto numPreds = [&graph](NodeIndex n, bool withExtraEdges) {
+        auto node = graph.getNode(n);
+        return static_cast<unsigned>(
+            (withExtraEdges ? node->end() : node->primary_end()) -
+            node->begin());
+    };
+
+    // The edges from addr-of constraints and the implicit edges are extra
+    EXPECT_EQ(numPreds(p, true), 1u);
+    EXPECT_EQ(numPreds(p, false), 0u);
+    EXPECT_EQ(numPreds(q, false), 1u);
+    EXPECT_EQ(numPreds(graph.getRefNodeIndex(q), true), 1u);
+    EXPECT_EQ(numPreds(graph.getRefNodeIndex(q), false), 0u);
+    EXPECT_EQ(numPreds(r, false), 1u);
+
+    // Merging q into p folds q into p and *q into *p, and drops the edges
+    // between them
+    factory.mergeNode(p, q);
+    graph.updateMerges();
+    EXPECT_EQ(numPreds(q, true), 0u);
+    EXPECT_EQ(numPreds(p, true), 1u);
+    EXPECT_EQ(numPreds(graph.getRefNodeIndex(p), true), 1u);
+    EXPECT_EQ(graph.getMergeTarget(graph.getRefNodeIndex(q)),
+              graph.getRefNodeIndex(p));
+
+    // p points to o only, so *p and *q are o: r = *q becomes r = o, which
+    // comes with *r = *o
+    graph.setUniquePointee(p, o);
+    graph.updateMerges();
+    EXPECT_EQ(graph.getMergeTarget(graph.getRefNodeIndex(q)), o);
+    EXPECT_EQ(graph.getMergeTarget(graph.getAdrNodeIndex(o)),
+              graph.getAdrNodeIndex(o));
+    ASSERT_EQ(numPreds(r, false), 1u);
+    EXPECT_EQ(*graph.getNode(r)->begin(), o);
+    EXPECT_EQ(numPreds(graph.getRefNodeIndex(r), true), 1u);
+
+    // r points to nothing, so *r doesn't get anything
+    graph.setNoPointee(r);
+    graph.updateMerges();
+    EXPECT_EQ(numPreds(graph.getRefNodeIndex(r), true), 0u);
+}
+
+TEST(AndersTest, CSRGraphTest) {
+    // 0 -> {1, 2}, 1 -> {2}, 2 -> {0} where 0 -> 2 is secondary, and 3 is
+    // isolated
+    auto addEdges = [](CSRGraph::Builder &builder) {
+        builder.addEdge(0, 1);
+        builder.addEdge(0, 2, true);
+        builder.addEdge(1, 2);
+        builder.addEdge(1, 2);
+        builder.addEdge(2, 0);
+    };
+    CSRGraph graph;
+    CSRGraph::Builder builder(4);
+    addEdges(builder);
+    builder.startFilling();
+    addEdges(builder);
+    builder.finish(graph);
+
+    EXPECT_EQ(graph.getNumNodes(), 4u);
+    // The duplicate edge is removed
+    EXPECT_EQ(graph.getNumEdges(), 4u);
+    EXPECT_TRUE(graph.isInGraph(0));
+    EXPECT_FALSE(graph.isInGraph(3));
+
+    auto node0 = graph.getNode(0);
+    EXPECT_EQ(node0->getNumEdges(), 2u);
+    EXPECT_EQ(node0->getNumPrimaryEdges(), 1u);
+    EXPECT_EQ(*node0->begin(), 1u);
+    EXPECT_EQ(*node0->primary_end(), 2u);
+    EXPECT_EQ(graph.getNode(1)->getNumEdges(), 1u);
+
+    unsigned numNodes = 0;
+    for (auto itr = graph.node_begin(), ite = graph.node_end(); itr != ite;
+         ++itr)
+        ++numNodes;
+    EXPECT_EQ(numNodes, 3u);
+}
+
+TEST(AndersTest, PtsSetStoreTest) {
+    AndersPtsSet set1, set2, set3, large;
+    set1.insert(3);
+    set1.insert(7);
+    set2.insert(7);
+    set2.insert(3);
+    set3.insert(3);
+    for (unsigned i = 100; i < 200; ++i)
+        large.insert(i);
+    large.insert(7);
+
+    AndersPtsSetStore store;
+    AndersPtsSetStore::Builder builder;
+    unsigned emptyId = builder.addSet(AndersPtsSet());
+    unsigned id1 = builder.addSet(set1);
+    // Equal sets are only stored once
+    EXPECT_EQ(builder.addSet(set2), id1);
+    unsigned id3 = builder.addSet(set3);
+    unsigned largeId = builder.addSet(large);
+    EXPECT_NE(id1, id3);
+    builder.finish(store);
+
+    EXPECT_EQ(store.getNumSets(), 4u);
+    EXPECT_EQ(store.getNumElements(), 104u);
+    EXPECT_TRUE(store.getSet(emptyId).empty());
+    ASSERT_EQ(store.getSet(id1).size(), 2u);
+    EXPECT_EQ(store.getSet(id1)[0], 3u);
+    EXPECT_EQ(store.getSet(id1)[1], 7u);
+
+    EXPECT_TRUE(
+        AndersPtsSetStore::intersectWith(store.getSet(id1), store.getSet(id3)));
+    EXPECT_FALSE(AndersPtsSetStore::intersectWithExcept(
+        store.getSet(id1), store.getSet(id3), 3));
+    EXPECT_FALSE(AndersPtsSetStore::intersectWith(store.getSet(emptyId),
+                                                  store.getSet(id1)));
+    // The small set is looked up in the large one
+    EXPECT_TRUE(AndersPtsSetStore::intersectWith(store.getSet(id1),
+                                                 store.getSet(largeId)));
+    EXPECT_FALSE(AndersPtsSetStore::intersectWith(store.getSet(id3),
+                                                  store.getSet(largeId)));
+    EXPECT_FALSE(AndersPtsSetStore::intersectWithExcept(
+        store.getSet(largeId), store.getSet(id1), 7));
 }
 
 TEST(AndersTest, NodeMergeTest) {
@@ -115,6 +247,206 @@ TEST(AndersTest, NodeMergeTest) {
     factory.mergeNode(n2, n4);
     EXPECT_EQ(factory.getMergeTarget(n1), factory.getMergeTarget(n2));
     EXPECT_EQ(factory.getMergeTarget(n3), factory.getMergeTarget(n4));
+
+    auto n5 = factory.createValueNode();
+    factory.mergeNode(n5, n2);
+    factory.flattenMergeTargets();
+    const AndersNodeFactory &constFactory = factory;
+    for (auto n : {n0, n1, n2, n3, n4, n5})
+        EXPECT_EQ(constFactory.getMergeTarget(n), n5);
+}
+
+TEST(AndersTest, LocationMergeTest) {
+    AndersNodeFactory factory;
+
+    auto o0 = factory.createObjectNode();
+    auto o1 = factory.createObjectNode();
+    auto o2 = factory.createObjectNode();
+    auto o3 = factory.createObjectNode();
+
+    EXPECT_TRUE(factory.getLocationEquivalents(o0).empty());
+
+    factory.mergeLocation(o0, o1);
+    factory.mergeLocation(o2, o3);
+    ASSERT_EQ(factory.getLocationEquivalents(o0).size(), 1u);
+    EXPECT_EQ(factory.getLocationEquivalents(o0)[0], o1);
+
+    // o2 already stands for o3, and o0 takes over both of them
+    factory.mergeLocation(o0, o2);
+    EXPECT_EQ(factory.getLocationEquivalents(o0).size(), 3u);
+    EXPECT_TRUE(factory.getLocationEquivalents(o2).empty());
+    EXPECT_TRUE(factory.getLocationEquivalents(o1).empty());
+}
+
+TEST(AndersTest, ObjectIdTest) {
+    AndersNodeFactory factory;
+
+    // The universal and null objects come first
+    EXPECT_EQ(factory.getNumObjects(), 2u);
+    EXPECT_EQ(factory.getObjectId(factory.getUniversalObjNode()), 0u);
+    EXPECT_EQ(factory.getObjectId(factory.getNullObjectNode()), 1u);
+
+    // Value nodes in between do not take up object ids
+    factory.createValueNode();
+    auto o0 = factory.createObjectNode();
+    factory.createValueNode();
+    factory.createValueNode();
+    auto o1 = factory.createObjectNode();
+    EXPECT_EQ(factory.getNumObjects(), 4u);
+    EXPECT_EQ(factory.getObjectId(o0), 2u);
+    EXPECT_EQ(factory.getObjectId(o1), 3u);
+    EXPECT_EQ(factory.getObjectNodeWithId(3), o1);
+
+    // A set over object ids is stored over the object nodes
+    AndersPtsSet set;
+    set.insert(factory.getObjectId(o1));
+    set.insert(factory.getObjectId(o0));
+    AndersPtsSetStore store;
+    AndersPtsSetStore::Builder builder;
+    unsigned id = builder.addSet(set, factory.getObjectNodes());
+    builder.finish(store);
+    ASSERT_EQ(store.getSet(id).size(), 2u);
+    EXPECT_EQ(store.getSet(id)[0], o0);
+    EXPECT_EQ(store.getSet(id)[1], o1);
+}
+
+TEST(AndersTest, NodeCompactorTest) {
+    AndersNodeFactory factory;
+    auto p0 = factory.createValueNode();
+    auto unused = factory.createValueNode();
+    auto o0 = factory.createObjectNode();
+    auto p1 = factory.createValueNode();
+    auto p2 = factory.createValueNode();
+    auto o1 = factory.createObjectNode();
+    factory.mergeNode(p1, p2);
+    factory.mergeNode(p0, o1);
+
+    std::vector<AndersConstraint> constraints;
+    constraints.emplace_back(AndersConstraint::ADDR_OF, p0, o0);
+    constraints.emplace_back(AndersConstraint::COPY, p1, p0);
+    constraints.emplace_back(AndersConstraint::LOAD, p2, p1);
+    constraints.emplace_back(AndersConstraint::ADDR_OF, p0, o1);
+
+    AndersNodeCompactor compactor(factory);
+    compactor.run(constraints);
+    AndersNodeFactory &compact = compactor.getCompactFactory();
+
+    // The special nodes and the objects come first, then p0 and p1 in the
+    // order the edges reach them. The unused node and p2 get no node
+    ASSERT_EQ(compact.getNumNodes(), 8u);
+    EXPECT_EQ(compact.getNumObjects(), factory.getNumObjects());
+    EXPECT_EQ(compact.getObjectId(compactor.getCompactNode(o0)),
+              factory.getObjectId(o0));
+    EXPECT_EQ(compactor.getCompactNode(p0), 6u);
+    EXPECT_EQ(compactor.getCompactNode(p1), 7u);
+    EXPECT_EQ(compactor.getCompactNode(p2), 7u);
+    EXPECT_EQ(compactor.getCompactNode(unused),
+              AndersNodeFactory::InvalidIndex);
+    EXPECT_EQ(compactor.getOriginalNode(7), p1);
+    // o1 keeps its own node as an object, which is merged into p0 as a pointer
+    EXPECT_EQ(compact.getMergeTarget(compact.getObjectNodeWithId(
+                  factory.getObjectId(o1))),
+              6u);
+
+    ASSERT_EQ(constraints.size(), 4u);
+    EXPECT_EQ(constraints[0],
+              AndersConstraint(AndersConstraint::ADDR_OF, 6,
+                               compactor.getCompactNode(o0)));
+    EXPECT_EQ(constraints[1], AndersConstraint(AndersConstraint::COPY, 7, 6));
+    EXPECT_EQ(constraints[2], AndersConstraint(AndersConstraint::LOAD, 7, 7));
+    EXPECT_EQ(constraints[3].getSrc(),
+              compact.getObjectNodeWithId(factory.getObjectId(o1)));
+
+    // Merges and points-to sets find their way back to the original nodes
+    std::map<NodeIndex, AndersPtsSet> ptsGraph;
+    compact.mergeNode(6, 7);
+    ptsGraph[6].insert(factory.getObjectId(o0));
+    compactor.mapBack(ptsGraph);
+    EXPECT_EQ(factory.getMergeTarget(p2), factory.getMergeTarget(p0));
+    ASSERT_EQ(ptsGraph.size(), 1u);
+    EXPECT_EQ(ptsGraph.begin()->first, factory.getMergeTarget(p1));
+    EXPECT_TRUE(ptsGraph.begin()->second.has(factory.getObjectId(o0)));
+}
+
+TEST(AndersTest, NodeCompactorPartTest) {
+    AndersNodeFactory factory;
+    auto p = factory.createValueNode();
+    auto q = factory.createValueNode();
+    auto o0 = factory.createObjectNode();
+    auto o1 = factory.createObjectNode();
+
+    std::vector<AndersConstraint> constraints;
+    constraints.emplace_back(AndersConstraint::ADDR_OF, p, o1);
+    constraints.emplace_back(AndersConstraint::COPY, q, p);
+
+    AndersNodeCompactor compactor(factory, false);
+    compactor.run(constraints);
+    AndersNodeFactory &compact = compactor.getCompactFactory();
+
+    // Only the special objects and o1 get a compact object, and o0 gets none
+    AndersNodeFactory fresh;
+    ASSERT_EQ(compact.getNumObjects(), fresh.getNumObjects() + 1);
+    EXPECT_EQ(compact.getNumNodes(), fresh.getNumNodes() + 3);
+    EXPECT_EQ(compactor.getCompactNode(o0), AndersNodeFactory::InvalidIndex);
+    NodeIndex compactObj = compactor.getCompactNode(o1);
+    EXPECT_EQ(compact.getObjectId(compactObj), fresh.getNumObjects());
+    EXPECT_EQ(constraints[0].getSrc(), compactObj);
+
+    // The points-to sets are translated back to the original object ids
+    std::map<NodeIndex, AndersPtsSet> ptsGraph;
+    ptsGraph[compactor.getCompactNode(q)].insert(
+        compact.getObjectId(compactObj));
+    ptsGraph[compactor.getCompactNode(q)].insert(
+        compact.getUniversalObjId());
+    compactor.mapBack(ptsGraph);
+    ASSERT_EQ(ptsGraph.size(), 1u);
+    EXPECT_EQ(ptsGraph.begin()->first, q);
+    AndersPtsSet &set = ptsGraph.begin()->second;
+    EXPECT_EQ(set.getSize(), 2u);
+    EXPECT_TRUE(set.has(factory.getObjectId(o1)));
+    EXPECT_TRUE(set.has(factory.getUniversalObjId()));
+}
+
+TEST(AndersTest, UnificationTest) {
+    AndersNodeFactory factory;
+    auto p = factory.createValueNode();
+    auto q = factory.createValueNode();
+    auto r = factory.createValueNode();
+    auto s = factory.createValueNode();
+    auto t = factory.createValueNode();
+    auto unused = factory.createValueNode();
+    auto o0 = factory.createObjectNode();
+    auto o1 = factory.createObjectNode();
+    auto o2 = factory.createObjectNode();
+
+    std::vector<AndersConstraint> constraints;
+    constraints.emplace_back(AndersConstraint::ADDR_OF, p, o0);
+    constraints.emplace_back(AndersConstraint::ADDR_OF, q, o1);
+    constraints.emplace_back(AndersConstraint::ADDR_OF, s, o2);
+    constraints.emplace_back(AndersConstraint::COPY, r, p);
+    constraints.emplace_back(AndersConstraint::COPY, r, q);
+    constraints.emplace_back(AndersConstraint::STORE, p, s);
+    constraints.emplace_back(AndersConstraint::LOAD, t, q);
+
+    AndersUnifier unifier(factory);
+    unifier.run(constraints);
+
+    // r joins what p and q point to, so all three point to both objects
+    ASSERT_EQ(unifier.getPointees(p).size(), 2u);
+    EXPECT_EQ(unifier.getPointees(p)[0], o0);
+    EXPECT_EQ(unifier.getPointees(p)[1], o1);
+    EXPECT_EQ(unifier.getPointeeClass(q), unifier.getPointeeClass(p));
+    EXPECT_EQ(unifier.getPointeeClass(r), unifier.getPointeeClass(p));
+
+    // The store through p reaches o1 as well, and the load through q sees it
+    ASSERT_EQ(unifier.getPointees(o1).size(), 1u);
+    EXPECT_EQ(unifier.getPointees(o1)[0], o2);
+    EXPECT_EQ(unifier.getPointeeClass(t), unifier.getPointeeClass(s));
+    EXPECT_NE(unifier.getPointeeClass(t), unifier.getPointeeClass(p));
+
+    // Nothing points to what the objects nobody stores into hold
+    EXPECT_EQ(unifier.getPointeeClass(o2), AndersNodeFactory::InvalidIndex);
+    EXPECT_TRUE(unifier.getPointees(unused).empty());
 }
 
 // This fixture assists in setting up the pass environments
@@ -139,6 +471,129 @@ protected:
 
         return module.get();
     }
+
+    // Parse a module where x and y are allocas, p is an alloca that holds x,
+    // and q is loaded from p
+    Module* ParseStoreLoadAssembly(Instruction *&x, Instruction *&y,
+                                   Instruction *&p, Instruction *&q) {
+        auto module = ParseAssembly("define i32 @main() {\n"
+                                    "bb:\n"
+                                    "  %x = alloca i32, align 4\n"
+                                    "  %y = alloca i32, align 4\n"
+                                    "  %p = alloca i32*, align 8\n"
+                                    "  store i32* %x, i32** %p, align 8\n"
+                                    "  %q = load i32*, i32** %p, align 8\n"
+                                    "  ret i32 0\n"
+                                    "}\n");
+
+        auto itr = module->begin()->begin()->begin();
+        x = &*itr;
+        y = &*++itr;
+        p = &*++itr;
+        ++itr;
+        q = &*++itr;
+        return module;
+    }
+
+    // Parse a module where p, q and r copy each other around a loop, and s
+    // goes through *pp and back, which is a cycle HCD finds offline
+    Module* ParseCyclicAssembly() {
+        return ParseAssembly(
+            "@g = global i32* null\n"
+            "define i32* @main() {\n"
+            "bb:\n"
+            "  %x = alloca i32, align 4\n"
+            "  %y = alloca i32, align 4\n"
+            "  %pp = alloca i32*, align 8\n"
+            "  store i32* %x, i32** %pp, align 8\n"
+            "  br label %loop\n"
+            "loop:\n"
+            "  %p = phi i32* [ %x, %bb ], [ %q, %loop ]\n"
+            "  %q = phi i32* [ %y, %bb ], [ %r, %loop ]\n"
+            "  %r = phi i32* [ %x, %bb ], [ %p, %loop ]\n"
+            "  store i32* %q, i32** %pp, align 8\n"
+            "  %s = load i32*, i32** %pp, align 8\n"
+            "  store i32* %s, i32** %pp, align 8\n"
+            "  store i32* %s, i32** @g, align 8\n"
+            "  %c = icmp eq i32* %s, %r\n"
+            "  br i1 %c, label %exit, label %loop\n"
+            "exit:\n"
+            "  %t = load i32*, i32** @g, align 8\n"
+            "  ret i32* %t\n"
+            "}\n");
+    }
+
+    // Set the command line option named name to value, and return the value
+    // it had
+    template <typename T> T SetOption(const char* name, const T& value) {
+        auto opt = cl::getRegisteredOptions().lookup(name);
+        if (!opt)
+            report_fatal_error(Twine("Unknown option ") + name);
+        auto typedOpt = static_cast<cl::opt<T>*>(opt);
+        T oldValue = typedOpt->getValue();
+        typedOpt->setValue(value);
+        return oldValue;
+    }
+
+    // What getPointsToSet() says about every pointer of a module, with the
+    // sets sorted
+    typedef std::vector<std::pair<bool, std::vector<const Value*>>>
+        PtsSetList;
+
+    // Solve module with the boolean options in opts turned on, and return
+    // the points-to sets of its pointers
+    PtsSetList SolveWithOptions(const Module& module,
+                                ArrayRef<const char*> opts) {
+        for (auto name : opts)
+            SetOption(name, true);
+        Andersen anders(module);
+        for (auto name : opts)
+            SetOption(name, false);
+
+        PtsSetList ptsSets;
+        auto addPtsSet = [&anders, &ptsSets](const Value& val) {
+            if (!val.getType()->isPointerTy())
+                return;
+            std::vector<const Value*> ptsSet;
+            bool known = anders.getPointsToSet(&val, ptsSet);
+            std::sort(ptsSet.begin(), ptsSet.end());
+            ptsSets.emplace_back(known, std::move(ptsSet));
+        };
+        for (auto& global : module.globals())
+            addPtsSet(global);
+        for (auto& f : module) {
+            for (auto& arg : f.args())
+                addPtsSet(arg);
+            for (auto& inst : instructions(f))
+                addPtsSet(inst);
+        }
+        return ptsSets;
+    }
+
+    // Build an alias analysis result of module with the boolean options in
+    // opts turned on
+    std::unique_ptr<AndersenAAResult>
+    GetAAWithOptions(const Module& module, ArrayRef<const char*> opts) {
+        for (auto name : opts)
+            SetOption(name, true);
+        std::unique_ptr<AndersenAAResult> aa(new AndersenAAResult(module));
+        for (auto name : opts)
+            SetOption(name, false);
+        return aa;
+    }
+
+    // Return the instruction or global of module named name
+    const Value* GetValue(const Module& module, StringRef name) {
+        for (auto& f : module) {
+            for (auto& inst : instructions(f)) {
+                if (inst.getName() == name)
+                    return &inst;
+            }
+        }
+        if (auto val = module.getNamedValue(name))
+            return val;
+        report_fatal_error(Twine("Unknown value ") + name);
+    }
 };
 
 TEST_F(AndersPassTest, NodeFactoryTest) {
@@ -177,4 +632,567 @@ TEST_F(AndersPassTest, NodeFactoryTest) {
     EXPECT_EQ(factory.getObjectNodeFor(w), ow);
 }
 
+TEST_F(AndersPassTest, AliasClassesTest) {
+    Instruction *x, *y, *p, *q;
+    auto module = ParseStoreLoadAssembly(x, y, p, q);
+
+    AndersenAAResult aa(*module);
+    std::vector<const Value *> ptrs = {x, y, p, q};
+    std::vector<unsigned> classes;
+    std::vector<AliasResult> matrix;
+    EXPECT_EQ(aa.getAliasClasses(ptrs, classes, &matrix), 3u);
+    ASSERT_EQ(classes.size(), 4u);
+    EXPECT_EQ(classes[0], classes[3]);
+    EXPECT_NE(classes[0], classes[1]);
+    EXPECT_NE(classes[0], classes[2]);
+    EXPECT_NE(classes[1], classes[2]);
+
+    ASSERT_EQ(matrix.size(), 16u);
+    for (unsigned i = 0; i < 4; ++i) {
+        for (unsigned j = 0; j < 4; ++j) {
+            EXPECT_EQ(matrix[i * 4 + j],
+                      aa.alias(MemoryLocation(ptrs[i], 4),
+                               MemoryLocation(ptrs[j], 4)));
+        }
+    }
+    EXPECT_EQ(matrix[0 * 4 + 3], MustAlias);
+    EXPECT_EQ(matrix[0 * 4 + 1], NoAlias);
+}
+
+TEST_F(AndersPassTest, FrozenQueryTest) {
+    auto module = ParseAssembly("define i32 @main() {\n"
+                                "bb:\n"
+                                "  %x = alloca i32, align 4\n"
+                                "  %y = alloca i32, align 4\n"
+                                "  %p = alloca i32*, align 8\n"
+                                "  store i32* %x, i32** %p, align 8\n"
+                                "  store i32* %y, i32** %p, align 8\n"
+                                "  %q = load i32*, i32** %p, align 8\n"
+                                "  ret i32 0\n"
+                                "}\n");
+
+    std::vector<const Value *> ptrs;
+    for (auto &inst : *module->begin()->begin()) {
+        if (inst.getType()->isPointerTy())
+            ptrs.push_back(&inst);
+    }
+    ASSERT_EQ(ptrs.size(), 4u);
+
+    AndersenAAResult aa(*module);
+    auto queryAll = [&aa, &ptrs](std::vector<AliasResult> &results) {
+        for (auto p1 : ptrs) {
+            for (auto p2 : ptrs) {
+                results.push_back(aa.alias(MemoryLocation(p1, 4),
+                                           MemoryLocation(p2, 4)));
+            }
+        }
+    };
+    std::vector<AliasResult> expected;
+    queryAll(expected);
+
+    aa.freeze();
+    EXPECT_TRUE(aa.isFrozen());
+    const unsigned numThreads = 4;
+    std::vector<std::vector<AliasResult>> results(numThreads);
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < numThreads; ++i) {
+        threads.emplace_back([&queryAll, &results, i]() {
+            for (unsigned round = 0; round < 100; ++round) {
+                results[i].clear();
+                queryAll(results[i]);
+            }
+        });
+    }
+    for (auto &thread : threads)
+        thread.join();
+    for (auto const &result : results)
+        EXPECT_EQ(result, expected);
+}
+
+TEST_F(AndersPassTest, ConstantMemoryTest) {
+    auto module = ParseAssembly("@c = constant i32 0\n"
+                                "@v = global i32 0\n"
+                                "define i32 @main() {\n"
+                                "bb:\n"
+                                "  %x = alloca i32, align 4\n"
+                                "  ret i32 0\n"
+                                "}\n");
+
+    auto c = module->getNamedGlobal("c");
+    auto v = module->getNamedGlobal("v");
+    auto x = &*module->begin()->begin()->begin();
+
+    AndersenAAResult aa(*module);
+    EXPECT_TRUE(aa.pointsToConstantMemory(MemoryLocation(c, 4), false));
+    EXPECT_FALSE(aa.pointsToConstantMemory(MemoryLocation(v, 4), false));
+    EXPECT_FALSE(aa.pointsToConstantMemory(MemoryLocation(x, 4), false));
+}
+
+TEST_F(AndersPassTest, PointedByTest) {
+    Instruction *x, *y, *p, *q;
+    auto module = ParseStoreLoadAssembly(x, y, p, q);
+
+    Andersen anders(*module);
+    std::vector<const Value *> ptrs;
+    ASSERT_TRUE(anders.getPointedBy(x, ptrs));
+    std::sort(ptrs.begin(), ptrs.end());
+    std::vector<const Value *> expected = {x, q};
+    std::sort(expected.begin(), expected.end());
+    EXPECT_EQ(ptrs, expected);
+
+    ASSERT_TRUE(anders.getPointedBy(y, ptrs));
+    ASSERT_EQ(ptrs.size(), 1u);
+    EXPECT_EQ(ptrs[0], y);
+
+    // q is not an allocation site
+    EXPECT_FALSE(anders.getPointedBy(q, ptrs));
+}
+
+TEST_F(AndersPassTest, PtsSetViewTest) {
+    Instruction *x, *y, *p, *q;
+    auto module = ParseStoreLoadAssembly(x, y, p, q);
+
+    Andersen anders(*module);
+    AndersPtsSetView xView, yView, qView;
+    EXPECT_FALSE(xView.isValid());
+    ASSERT_TRUE(anders.getPointsToSetView(x, xView));
+    ASSERT_TRUE(anders.getPointsToSetView(y, yView));
+    ASSERT_TRUE(anders.getPointsToSetView(q, qView));
+
+    EXPECT_EQ(xView.getSize(), 1u);
+    EXPECT_EQ(anders.getAllocationSiteFor(*xView.begin()), x);
+    EXPECT_TRUE(anders.getLocationEquivalents(*xView.begin()).empty());
+    EXPECT_TRUE(xView == qView);
+    EXPECT_TRUE(xView.intersectWith(qView));
+    EXPECT_TRUE(xView != yView);
+    EXPECT_FALSE(xView.intersectWith(yView));
+}
+
+TEST_F(AndersPassTest, UniversalPtsSetTest) {
+    auto module = ParseAssembly("define i32 @main() {\n"
+                                "bb:\n"
+                                "  %x = alloca i32*, align 8\n"
+                                "  %y = alloca i32, align 4\n"
+                                "  %a = alloca i64, align 8\n"
+                                "  %n = load i64, i64* %a, align 8\n"
+                                "  %p = inttoptr i64 %n to i32**\n"
+                                "  store i32* %y, i32** %p, align 8\n"
+                                "  %q = load i32*, i32** %x, align 8\n"
+                                "  %r = load i32*, i32** %p, align 8\n"
+                                "  ret i32 0\n"
+                                "}\n");
+
+    auto f = module->begin();
+    auto bb = f->begin();
+    auto itr = bb->begin();
+    auto x = &*itr;
+    auto y = &*++itr;
+    ++itr;
+    ++itr;
+    auto p = &*++itr;
+    ++itr;
+    auto q = &*++itr;
+    auto r = &*++itr;
+
+    Andersen anders(*module);
+    AndersenAAResult aa(*module);
+    // p may point to anything, and so may whatever is loaded through it
+    std::vector<const Value *> ptsSet;
+    EXPECT_FALSE(anders.getPointsToSet(p, ptsSet));
+    EXPECT_FALSE(anders.getPointsToSet(r, ptsSet));
+    AndersPtsSetView view;
+    EXPECT_FALSE(anders.getPointsToSetView(p, view));
+    EXPECT_EQ(aa.alias(MemoryLocation(p, 4), MemoryLocation(x, 4)), MayAlias);
+
+    // What is stored through p may be loaded out of any object
+    ASSERT_TRUE(anders.getPointsToSet(q, ptsSet));
+    ASSERT_EQ(ptsSet.size(), 1u);
+    EXPECT_EQ(ptsSet[0], y);
+    EXPECT_NE(aa.alias(MemoryLocation(q, 4), MemoryLocation(y, 4)), NoAlias);
+    EXPECT_EQ(aa.alias(MemoryLocation(x, 4), MemoryLocation(y, 4)), NoAlias);
+}
+
+TEST_F(AndersPassTest, NewPassManagerTest) {
+    auto module = ParseAssembly("define i32 @main() {\n"
+                                "bb:\n"
+                                "  %x = alloca i32, align 4\n"
+                                "  %y = alloca i32, align 4\n"
+                                "  ret i32 0\n"
+                                "}\n");
+
+    auto f = &*module->begin();
+    auto itr = f->begin()->begin();
+    auto x = &*itr;
+    auto y = &*++itr;
+
+    ModuleAnalysisManager mam;
+    FunctionAnalysisManager fam;
+    mam.registerPass([] { return AndersenAA(); });
+    mam.registerPass(
+        [&fam] { return FunctionAnalysisManagerModuleProxy(fam); });
+    fam.registerPass(
+        [&mam] { return ModuleAnalysisManagerFunctionProxy(mam); });
+    fam.registerPass([] { return TargetLibraryAnalysis(); });
+    fam.registerPass([] {
+        AAManager aaManager;
+        aaManager.registerModuleAnalysis<AndersenAA>();
+        return aaManager;
+    });
+
+    // The result is computed once and then served from the cache
+    EXPECT_EQ(mam.getCachedResult<AndersenAA>(*module), nullptr);
+    AndersenAAResult &result = mam.getResult<AndersenAA>(*module);
+    EXPECT_EQ(&mam.getResult<AndersenAA>(*module), &result);
+    EXPECT_EQ(result.alias(MemoryLocation(x, 4), MemoryLocation(y, 4)),
+              NoAlias);
+
+    // Function passes see it through the AA aggregation
+    AAResults &aaResults = fam.getResult<AAManager>(*f);
+    EXPECT_EQ(aaResults.alias(MemoryLocation(x, 4), MemoryLocation(y, 4)),
+              NoAlias);
+
+    // It is only dropped when a pass abandons it explicitly
+    mam.invalidate(*module, PreservedAnalyses::none());
+    EXPECT_EQ(mam.getCachedResult<AndersenAA>(*module), &result);
+    PreservedAnalyses pa = PreservedAnalyses::all();
+    pa.abandon<AndersenAA>();
+    mam.invalidate(*module, pa);
+    EXPECT_EQ(mam.getCachedResult<AndersenAA>(*module), nullptr);
+}
+
+TEST_F(AndersPassTest, ValueMaintenanceTest) {
+    Instruction *x, *y, *p, *q;
+    auto module = ParseStoreLoadAssembly(x, y, p, q);
+
+    Andersen anders(*module);
+    AndersenAAResult aa(*module);
+    EXPECT_EQ(aa.alias(MemoryLocation(q, 4), MemoryLocation(y, 4)), NoAlias);
+    std::vector<const Value *> allocs;
+    anders.getAllAllocationSites(allocs);
+    unsigned numAllocs = allocs.size();
+
+    // A clone shares the result of its origin
+    Instruction *qc = q->clone();
+    qc->insertAfter(q);
+    anders.copyValue(q, qc);
+    aa.copyValue(q, qc);
+    std::vector<const Value *> ptsSet;
+    ASSERT_TRUE(anders.getPointsToSet(qc, ptsSet));
+    ASSERT_EQ(ptsSet.size(), 1u);
+    EXPECT_EQ(ptsSet[0], x);
+    std::vector<const Value *> ptrs;
+    ASSERT_TRUE(anders.getPointedBy(x, ptrs));
+    EXPECT_NE(std::find(ptrs.begin(), ptrs.end(), qc), ptrs.end());
+
+    // A replacement takes over the nodes of the value it replaces
+    auto x2 = new AllocaInst(Type::getInt32Ty(module->getContext()), 0,
+                             "x2", x);
+    x->replaceAllUsesWith(x2);
+    x->eraseFromParent();
+    ASSERT_TRUE(anders.getPointsToSet(qc, ptsSet));
+    ASSERT_EQ(ptsSet.size(), 1u);
+    EXPECT_EQ(ptsSet[0], x2);
+    ASSERT_TRUE(anders.getPointedBy(x2, ptrs));
+    EXPECT_NE(std::find(ptrs.begin(), ptrs.end(), x2), ptrs.end());
+    EXPECT_NE(std::find(ptrs.begin(), ptrs.end(), qc), ptrs.end());
+    EXPECT_EQ(aa.alias(MemoryLocation(qc, 4), MemoryLocation(x2, 4)),
+              MustAlias);
+
+    // A deleted value drops out, and the analysis has to be frozen again
+    anders.freeze();
+    aa.freeze();
+    EXPECT_TRUE(aa.isFrozen());
+    q->eraseFromParent();
+    y->eraseFromParent();
+    EXPECT_FALSE(anders.isFrozen());
+    EXPECT_FALSE(aa.isFrozen());
+    anders.getAllAllocationSites(allocs);
+    EXPECT_EQ(allocs.size(), numAllocs - 1);
+    ASSERT_TRUE(anders.getPointedBy(x2, ptrs));
+    for (auto ptr : ptrs)
+        EXPECT_NE(ptr, nullptr);
+    EXPECT_EQ(aa.alias(MemoryLocation(qc, 4), MemoryLocation(x2, 4)),
+              MustAlias);
+}
+
+TEST_F(AndersPassTest, CloneAliasTest) {
+    Instruction *x, *y, *p, *q;
+    auto module = ParseStoreLoadAssembly(x, y, p, q);
+
+    AndersenAAResult aa(*module);
+    EXPECT_EQ(aa.alias(MemoryLocation(q, 4), MemoryLocation(x, 4)), MustAlias);
+
+    // Two clones of one alloca (e.g. from inlining its function twice) are
+    // different stack slots, though they share the nodes of the alloca
+    Instruction *x1 = x->clone();
+    Instruction *x2 = x->clone();
+    x1->insertAfter(x);
+    x2->insertAfter(x1);
+    aa.copyValue(x, x1);
+    aa.copyValue(x, x2);
+    EXPECT_EQ(aa.alias(MemoryLocation(x1, 4), MemoryLocation(x2, 4)),
+              MayAlias);
+    EXPECT_EQ(aa.alias(MemoryLocation(x, 4), MemoryLocation(x1, 4)),
+              MayAlias);
+    EXPECT_EQ(aa.alias(MemoryLocation(q, 4), MemoryLocation(x, 4)), MayAlias);
+
+    std::vector<unsigned> classes;
+    std::vector<AliasResult> matrix;
+    const Value *ptrs[] = {x1, x2};
+    aa.getAliasClasses(ptrs, classes, &matrix);
+    EXPECT_EQ(classes[0], classes[1]);
+    EXPECT_EQ(matrix[1], MayAlias);
+}
+
+TEST_F(AndersPassTest, AsyncSolveTest) {
+    Instruction *x, *y, *p, *q;
+    auto module = ParseStoreLoadAssembly(x, y, p, q);
+
+    Andersen syncAnders(*module);
+    Andersen asyncAnders(*module, true);
+    AndersenAAResult aa(*module, true);
+
+    // The IR may change while the analysis is being solved
+    y->eraseFromParent();
+
+    for (auto ptr : {x, p, q}) {
+        std::vector<const Value *> syncSet, asyncSet;
+        ASSERT_TRUE(syncAnders.getPointsToSet(ptr, syncSet));
+        ASSERT_TRUE(asyncAnders.getPointsToSet(ptr, asyncSet));
+        EXPECT_EQ(syncSet, asyncSet);
+    }
+    EXPECT_TRUE(asyncAnders.isSolved());
+    EXPECT_EQ(aa.alias(MemoryLocation(q, 4), MemoryLocation(x, 4)),
+              MustAlias);
+    EXPECT_EQ(aa.alias(MemoryLocation(q, 4), MemoryLocation(p, 4)), NoAlias);
+    EXPECT_TRUE(aa.isReady());
+}
+
+TEST_F(AndersPassTest, PKHSolveTest) {
+    auto module = ParseCyclicAssembly();
+
+    PtsSetList expected = SolveWithOptions(*module, {});
+    EXPECT_EQ(SolveWithOptions(*module, {"enable-pkh"}), expected);
+    EXPECT_EQ(SolveWithOptions(
+                  *module, {"enable-pkh", "pull-propagation", "enable-hcd"}),
+              expected);
+}
+
+TEST_F(AndersPassTest, PartitionSolveTest) {
+    // @f, @g and @h don't share a pointer, so each is a component of its own.
+    // @f and @g both store through a pointer that may point anywhere, so what
+    // they store reaches every object, and q and r load both x and y. That
+    // only comes out right when the parts of @f and @g are solved again
+    // together
+    auto module = ParseAssembly("define void @f(i64 %n) {\n"
+                                "bb:\n"
+                                "  %u = inttoptr i64 %n to i32**\n"
+                                "  %x = alloca i32, align 4\n"
+                                "  store i32* %x, i32** %u, align 8\n"
+                                "  %p = alloca i32*, align 8\n"
+                                "  %q = load i32*, i32** %p, align 8\n"
+                                "  ret void\n"
+                                "}\n"
+                                "define void @g(i64 %n) {\n"
+                                "bb:\n"
+                                "  %u = inttoptr i64 %n to i32**\n"
+                                "  %y = alloca i32, align 4\n"
+                                "  store i32* %y, i32** %u, align 8\n"
+                                "  %p = alloca i32*, align 8\n"
+                                "  %r = load i32*, i32** %p, align 8\n"
+                                "  ret void\n"
+                                "}\n"
+                                "define void @h() {\n"
+                                "bb:\n"
+                                "  %z = alloca i32, align 4\n"
+                                "  %p = alloca i32*, align 8\n"
+                                "  store i32* %z, i32** %p, align 8\n"
+                                "  %s = load i32*, i32** %p, align 8\n"
+                                "  ret void\n"
+                                "}\n");
+
+    // Keep every component in a part of its own
+    unsigned minPartSize = SetOption("partition-min-size", 1u);
+    PtsSetList expected = SolveWithOptions(*module, {});
+    EXPECT_EQ(SolveWithOptions(*module, {"partition-solve"}), expected);
+    EXPECT_EQ(SolveWithOptions(*module, {"partition-solve", "enable-hcd"}),
+              expected);
+    SetOption("partition-min-size", minPartSize);
+
+    auto q = &*std::prev(module->getFunction("f")->begin()->end(), 2);
+    std::vector<const Value*> ptsSet;
+    Andersen anders(*module);
+    ASSERT_TRUE(anders.getPointsToSet(q, ptsSet));
+    EXPECT_EQ(ptsSet.size(), 2u);
+}
+
+TEST_F(AndersPassTest, LocationEquivalenceTest) {
+    // x and y are only ever stored into p together, so every pointer loaded
+    // from p points to both of them
+    auto module = ParseAssembly("define i32 @main() {\n"
+                                "bb:\n"
+                                "  %x = alloca i32, align 4\n"
+                                "  %y = alloca i32, align 4\n"
+                                "  %p = alloca i32*, align 8\n"
+                                "  store i32* %x, i32** %p, align 8\n"
+                                "  store i32* %y, i32** %p, align 8\n"
+                                "  %q = load i32*, i32** %p, align 8\n"
+                                "  %r = load i32*, i32** %p, align 8\n"
+                                "  ret i32 0\n"
+                                "}\n");
+    auto q = GetValue(*module, "q");
+    auto r = GetValue(*module, "r");
+
+    PtsSetList expected = SolveWithOptions(*module, {});
+    EXPECT_EQ(SolveWithOptions(*module, {"enable-le"}), expected);
+    EXPECT_EQ(SolveWithOptions(*module, {"enable-hvn", "enable-le"}),
+              expected);
+
+    // A class of objects is not a single object
+    auto aa = GetAAWithOptions(*module, {"enable-le"});
+    EXPECT_EQ(aa->alias(MemoryLocation(q, 4), MemoryLocation(r, 4)),
+              MayAlias);
+}
+
+TEST_F(AndersPassTest, IteratedOfflineTest) {
+    // p and q are copies of s, and HVN finds that they only point to the
+    // object of s. Only then are the loads through them rewritten into
+    // copies out of that object, and a and b become equivalent in the round
+    // after
+    auto module = ParseAssembly("define i32 @main() {\n"
+                                "bb:\n"
+                                "  %x = alloca i32, align 4\n"
+                                "  %y = alloca i32, align 4\n"
+                                "  %s = alloca i32*, align 8\n"
+                                "  store i32* %x, i32** %s, align 8\n"
+                                "  store i32* %y, i32** %s, align 8\n"
+                                "  %p = getelementptr i32*, i32** %s, i64 0\n"
+                                "  %q = getelementptr i32*, i32** %s, i64 0\n"
+                                "  %a = load i32*, i32** %p, align 8\n"
+                                "  %b = load i32*, i32** %q, align 8\n"
+                                "  ret i32 0\n"
+                                "}\n");
+    auto a = GetValue(*module, "a");
+    auto b = GetValue(*module, "b");
+
+    PtsSetList expected = SolveWithOptions(*module, {});
+    EXPECT_EQ(SolveWithOptions(*module, {"enable-hvn"}), expected);
+    EXPECT_EQ(SolveWithOptions(*module, {"enable-hr"}), expected);
+    EXPECT_EQ(SolveWithOptions(*module, {"enable-hu"}), expected);
+    EXPECT_EQ(SolveWithOptions(*module, {"enable-hru"}), expected);
+
+    // a and b point to two objects, so they only must-alias if they share a
+    // node
+    auto hvn = GetAAWithOptions(*module, {"enable-hvn"});
+    EXPECT_EQ(hvn->alias(MemoryLocation(a, 4), MemoryLocation(b, 4)),
+              MayAlias);
+    auto hr = GetAAWithOptions(*module, {"enable-hr"});
+    EXPECT_EQ(hr->alias(MemoryLocation(a, 4), MemoryLocation(b, 4)),
+              MustAlias);
+    auto hru = GetAAWithOptions(*module, {"enable-hru"});
+    EXPECT_EQ(hru->alias(MemoryLocation(a, 4), MemoryLocation(b, 4)),
+              MustAlias);
+}
+
+TEST_F(AndersPassTest, LazyCycleDetectionTest) {
+    // p, q and r copy each other around the loop, so they end up with equal
+    // points-to sets, and LCD collapses them
+    auto module = ParseAssembly("define i32 @main() {\n"
+                                "bb:\n"
+                                "  %x = alloca i32, align 4\n"
+                                "  %y = alloca i32, align 4\n"
+                                "  br label %loop\n"
+                                "loop:\n"
+                                "  %p = phi i32* [ %x, %bb ], [ %r, %loop ]\n"
+                                "  %q = phi i32* [ %y, %bb ], [ %p, %loop ]\n"
+                                "  %r = phi i32* [ %x, %bb ], [ %q, %loop ]\n"
+                                "  %c = icmp eq i32* %p, %q\n"
+                                "  br i1 %c, label %exit, label %loop\n"
+                                "exit:\n"
+                                "  ret i32 0\n"
+                                "}\n");
+    auto p = GetValue(*module, "p");
+    auto q = GetValue(*module, "q");
+    auto r = GetValue(*module, "r");
+
+    EXPECT_EQ(SolveWithOptions(*module, {"enable-lcd"}),
+              SolveWithOptions(*module, {}));
+
+    // They point to two objects, so they only must-alias once they share a
+    // node
+    auto aa = GetAAWithOptions(*module, {});
+    EXPECT_EQ(aa->alias(MemoryLocation(p, 4), MemoryLocation(q, 4)),
+              MayAlias);
+    auto lcd = GetAAWithOptions(*module, {"enable-lcd"});
+    EXPECT_EQ(lcd->alias(MemoryLocation(p, 4), MemoryLocation(q, 4)),
+              MustAlias);
+    EXPECT_EQ(lcd->alias(MemoryLocation(p, 4), MemoryLocation(r, 4)),
+              MustAlias);
+}
+
+TEST_F(AndersPassTest, PullPropagationTest) {
+    auto module = ParseCyclicAssembly();
+
+    PtsSetList expected = SolveWithOptions(*module, {});
+    EXPECT_EQ(SolveWithOptions(*module, {"pull-propagation"}), expected);
+    EXPECT_EQ(SolveWithOptions(*module, {"pull-propagation", "enable-lcd"}),
+              expected);
+    EXPECT_EQ(SolveWithOptions(*module, {"pull-propagation", "enable-hcd"}),
+              expected);
+}
+
+TEST_F(AndersPassTest, UnificationSolveTest) {
+    // r selects between p and q, so unification puts a and b in one class,
+    // and x and y in another. What @f stores through u may reach any object
+    auto module = ParseAssembly("define void @f(i1 %c, i64 %n) {\n"
+                                "bb:\n"
+                                "  %x = alloca i32, align 4\n"
+                                "  %y = alloca i32, align 4\n"
+                                "  %a = alloca i32*, align 8\n"
+                                "  %b = alloca i32*, align 8\n"
+                                "  store i32* %x, i32** %a, align 8\n"
+                                "  store i32* %y, i32** %b, align 8\n"
+                                "  %s = alloca i32**, align 8\n"
+                                "  store i32** %a, i32*** %s, align 8\n"
+                                "  %p = load i32**, i32*** %s, align 8\n"
+                                "  %q = select i1 %c, i32** %a, i32** %b\n"
+                                "  %r = select i1 %c, i32** %p, i32** %q\n"
+                                "  %t = load i32*, i32** %r, align 8\n"
+                                "  %u = inttoptr i64 %n to i32**\n"
+                                "  store i32* %x, i32** %u, align 8\n"
+                                "  %v = load i32*, i32** %u, align 8\n"
+                                "  ret void\n"
+                                "}\n");
+    auto cyclic = ParseCyclicAssembly();
+
+    // The unification pre-analysis only drops constraints that can't change
+    // the solution, so the points-to sets stay exactly the same
+    EXPECT_EQ(SolveWithOptions(*module, {"enable-unify"}),
+              SolveWithOptions(*module, {}));
+    EXPECT_EQ(SolveWithOptions(*cyclic, {"enable-unify"}),
+              SolveWithOptions(*cyclic, {}));
+
+    // Steensgaard's solution may only grow a points-to set or give it up
+    auto expectSuperset = [](const PtsSetList& super, const PtsSetList& sub) {
+        ASSERT_EQ(super.size(), sub.size());
+        for (unsigned i = 0, e = sub.size(); i < e; ++i) {
+            if (!sub[i].first) {
+                EXPECT_FALSE(super[i].first) << "pointer " << i;
+                continue;
+            }
+            if (!super[i].first)
+                continue;
+            EXPECT_TRUE(std::includes(super[i].second.begin(),
+                                      super[i].second.end(),
+                                      sub[i].second.begin(),
+                                      sub[i].second.end()))
+                << "pointer " << i;
+        }
+    };
+    expectSuperset(SolveWithOptions(*module, {"steensgaard"}),
+                   SolveWithOptions(*module, {}));
+    expectSuperset(SolveWithOptions(*cyclic, {"steensgaard"}),
+                   SolveWithOptions(*cyclic, {}));
+}
+
 } // end of anonymous namespace